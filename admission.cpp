@@ -0,0 +1,101 @@
+#include "admission.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unordered_map>
+#include "http_conn.h"
+#include "locker.h"
+#include "metrics.h"
+
+int admission::m_max_conns = 0;
+int admission::m_max_queue = 0;
+int admission::m_max_per_ip = 0;
+int admission::m_retry_after = 1;
+
+// 每个IP的连接数。分成若干段各自加锁，不同reactor的accept和工作线程中的关闭很少争同一把锁
+static const int IP_STRIPES = 16;
+struct ip_stripe {
+    locker lock;
+    std::unordered_map< in_addr_t, int > counts;
+};
+static ip_stripe ip_stripes[ IP_STRIPES ];
+
+static ip_stripe& stripe_of( in_addr_t ip ) {
+    return ip_stripes[ ( ip * 2654435761u ) >> 28 ];
+}
+
+bool admission::overloaded( int queued ) {
+    return ( m_max_conns > 0 && http_conn::m_user_count >= m_max_conns )
+        || ( m_max_queue > 0 && queued >= m_max_queue );
+}
+
+bool admission::recovered( int queued ) {
+    return ( m_max_conns <= 0 || http_conn::m_user_count < m_max_conns - m_max_conns / 10 )
+        && ( m_max_queue <= 0 || queued < m_max_queue - m_max_queue / 10 );
+}
+
+// 监听socket保持在epoll中，只是不再关注任何事件
+void admission::pause_accept( int epollfd, int listenfd ) {
+    epoll_event event;
+    event.events = 0;
+    event.data.u64 = listenfd;
+    epoll_ctl( epollfd, EPOLL_CTL_MOD, listenfd, &event );
+    metrics::add( CNT_ACCEPT_PAUSES );
+}
+
+void admission::resume_accept( int epollfd, int listenfd ) {
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.u64 = listenfd;
+    epoll_ctl( epollfd, EPOLL_CTL_MOD, listenfd, &event );
+}
+
+bool admission::admit_ip( in_addr_t ip ) {
+    if ( m_max_per_ip <= 0 ) {
+        return true;
+    }
+    ip_stripe& s = stripe_of( ip );
+    s.lock.lock();
+    int& count = s.counts[ ip ];
+    bool ok = count < m_max_per_ip;
+    if ( ok ) {
+        count++;
+    } else if ( count == 0 ) {
+        s.counts.erase( ip );
+    }
+    s.lock.unlock();
+    return ok;
+}
+
+void admission::release_ip( in_addr_t ip ) {
+    if ( m_max_per_ip <= 0 ) {
+        return;
+    }
+    ip_stripe& s = stripe_of( ip );
+    s.lock.lock();
+    std::unordered_map< in_addr_t, int >::iterator it = s.counts.find( ip );
+    if ( it != s.counts.end() && --it->second <= 0 ) {
+        s.counts.erase( it );
+    }
+    s.lock.unlock();
+}
+
+void admission::send_503( int fd ) {
+    char response[ 160 ];
+    int len = snprintf( response, sizeof( response ),
+                        "HTTP/1.1 503 Service Unavailable\r\nRetry-After: %d\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+                        m_retry_after );
+    send( fd, response, len, MSG_NOSIGNAL | MSG_DONTWAIT );
+    metrics::add( CNT_STATUS_5XX );
+}
+
+//先读掉已经到达的请求（最多几次，不让客户端拖住reactor）：
+//关闭时接收缓冲区里还有数据，内核会发RST，客户端可能收不到503
+void admission::reject( int fd ) {
+    char buf[ 4096 ];
+    for ( int i = 0; i < 4 && recv( fd, buf, sizeof( buf ), MSG_DONTWAIT ) > 0; ++i ) {
+    }
+    send_503( fd );
+    close( fd );
+}
@@ -0,0 +1,40 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <netinet/in.h>
+
+/*
+过载时的准入控制，目标是让已接受的请求延迟有上界，超出能力的部分尽快拒绝而不是排队：
+1. 线程池排队的任务数达到m_max_queue（或队列已满）时，reactor不再把请求交给线程池，
+   直接回复503和Retry-After后关闭连接，不经过工作线程
+2. 连接数达到m_max_conns或排队数达到m_max_queue时暂停accept（监听socket不再报告事件），
+   新连接留在内核的全连接队列里；两者都降到高水位的9/10以下再恢复，避免来回抖动
+3. 同一个客户端IP同时最多m_max_per_ip个连接，超过的连接回复503后关闭
+各项为0表示不限制。
+*/
+class admission {
+public:
+    static int m_max_conns;
+    static int m_max_queue;
+    static int m_max_per_ip;
+    static int m_retry_after;       // 503响应中Retry-After的秒数
+
+    // 是否超过高水位，应该暂停accept
+    static bool overloaded( int queued );
+    // 暂停之后是否都已降到低水位以下，可以恢复accept
+    static bool recovered( int queued );
+    static void pause_accept( int epollfd, int listenfd );
+    static void resume_accept( int epollfd, int listenfd );
+
+    // 新连接占用一个该IP的名额，超过上限返回false（不占用）
+    static bool admit_ip( in_addr_t ip );
+    // 连接关闭时归还名额，只对admit_ip返回true的连接调用
+    static void release_ip( in_addr_t ip );
+
+    // 回复503并关闭还没有注册的新连接
+    static void reject( int fd );
+    // 向socket发送固定的503响应（Connection: close），不等待也不重试
+    static void send_503( int fd );
+};
+
+#endif
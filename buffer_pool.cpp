@@ -0,0 +1,89 @@
+#include "buffer_pool.h"
+#include <stdlib.h>
+#include "locker.h"
+
+static const int CLASS_NUM = 6;         // 2KB,4KB,...,64KB
+static const int CACHE_BYTES = 256 * 1024;   // 每个线程每一档最多缓存的字节数
+
+struct free_node {
+    free_node* next;
+};
+
+// 线程本地的空闲链表
+static __thread free_node* local_list[CLASS_NUM];
+static __thread int local_count[CLASS_NUM];
+
+// 全局仓库，以一批为单位在线程之间转移
+static locker depot_lock;
+static free_node* depot_list[CLASS_NUM];
+static int depot_count[CLASS_NUM];
+
+static int size_class(int size){
+    int c = 0;
+    while ((buffer_pool::MIN_SIZE << c) < size){
+        ++c;
+    }
+    return c;
+}
+
+// 本档一次转移的缓冲区个数（本地缓存上限的一半）
+static int batch_count(int c){
+    return CACHE_BYTES / (buffer_pool::MIN_SIZE << c) / 2;
+}
+
+char* buffer_pool::acquire(int& size){
+    if (size > MAX_SIZE){
+        return NULL;
+    }
+    int c = size_class(size);
+    size = MIN_SIZE << c;
+    if (!local_list[c]){
+        //本地为空，从仓库取一批
+        int batch = batch_count(c);
+        depot_lock.lock();
+        while (depot_list[c] && local_count[c] < batch){
+            free_node* node = depot_list[c];
+            depot_list[c] = node->next;
+            depot_count[c]--;
+            node->next = local_list[c];
+            local_list[c] = node;
+            local_count[c]++;
+        }
+        depot_lock.unlock();
+    }
+    free_node* node = local_list[c];
+    if (!node){
+        return (char*)malloc(size);
+    }
+    local_list[c] = node->next;
+    local_count[c]--;
+    return (char*)node;
+}
+
+void buffer_pool::release(char* buf, int size){
+    int c = size_class(size);
+    free_node* node = (free_node*)buf;
+    node->next = local_list[c];
+    local_list[c] = node;
+    local_count[c]++;
+    if (local_count[c] * size <= CACHE_BYTES){
+        return;
+    }
+
+    //本地缓存满了，一半交给仓库，仓库也满了就直接释放
+    int batch = batch_count(c);
+    depot_lock.lock();
+    for (int i = 0; i < batch; ++i){
+        node = local_list[c];
+        local_list[c] = node->next;
+        local_count[c]--;
+        if (depot_count[c] * size < CACHE_BYTES * 16){
+            node->next = depot_list[c];
+            depot_list[c] = node;
+            depot_count[c]++;
+        } else {
+            free(node);
+        }
+    }
+    depot_lock.unlock();
+}
@@ -0,0 +1,22 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+/*
+连接读写缓冲区的内存池。缓冲区按2的幂分档（MIN_SIZE到MAX_SIZE），
+连接只在有数据要读写时才持有缓冲区，空闲后归还，不再为每个fd常驻两块固定数组。
+每个线程每一档有自己的空闲链表，分配和归还都不加锁；
+链表过长时把一批还给全局仓库，为空时再从仓库取一批，
+这样在reactor线程分配、工作线程归还（或反过来）时内存也能循环使用。
+*/
+class buffer_pool {
+public:
+    static const int MIN_SIZE = 2048;
+    static const int MAX_SIZE = 65536;
+
+    // 分配不小于size的缓冲区，size改为实际大小，超过MAX_SIZE返回NULL。内容不做初始化
+    static char* acquire(int& size);
+    // size必须是acquire返回的大小
+    static void release(char* buf, int size);
+};
+
+#endif
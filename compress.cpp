@@ -0,0 +1,114 @@
+#include "compress.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+#include <brotli/encode.h>
+
+//压缩结果会被缓存，每个文件只压缩一次，所以用较高的压缩级别
+static const int GZIP_LEVEL = 9;
+static const int BROTLI_QUALITY = 9;
+
+const char* encoding_name(int encoding){
+    switch (encoding) {
+        case ENCODING_GZIP: return "gzip";
+        case ENCODING_BR: return "br";
+        default: return NULL;
+    }
+}
+
+const char* encoding_suffix(int encoding){
+    switch (encoding) {
+        case ENCODING_GZIP: return ".gz";
+        case ENCODING_BR: return ".br";
+        default: return "";
+    }
+}
+
+//如"gzip, deflate, br;q=0.8, *;q=0"
+int parse_accept_encoding(const char* s, int len){
+    int accept = 0;
+    const char* end = s + len;
+    while (s < end) {
+        while (s < end && (*s == ' ' || *s == '\t' || *s == ',')) {
+            ++s;
+        }
+        const char* token = s;
+        while (s < end && *s != ',' && *s != ';' && *s != ' ' && *s != '\t') {
+            ++s;
+        }
+        int token_len = s - token;
+        //参数中只关心q=0
+        bool refused = false;
+        while (s < end && *s != ',') {
+            if (*s == '=' && s > token && (s[-1] == 'q' || s[-1] == 'Q')) {
+                double q = strtod(s + 1, NULL);
+                refused = (q <= 0);
+            }
+            ++s;
+        }
+        if (refused || token_len == 0) {
+            continue;
+        }
+        if (token_len == 4 && strncasecmp(token, "gzip", 4) == 0) {
+            accept |= 1 << ENCODING_GZIP;
+        } else if (token_len == 2 && strncasecmp(token, "br", 2) == 0) {
+            accept |= 1 << ENCODING_BR;
+        }
+    }
+    return accept;
+}
+
+int next_encoding(int accept, int after){
+    //优先级从高到低
+    static const int order[] = { ENCODING_BR, ENCODING_GZIP };
+    int i = 0;
+    if (after != ENCODING_IDENTITY) {
+        while (order[i] != after) {
+            ++i;
+        }
+        ++i;
+    }
+    for (; i < (int)(sizeof(order) / sizeof(order[0])); ++i) {
+        if (accept & (1 << order[i])) {
+            return order[i];
+        }
+    }
+    return ENCODING_IDENTITY;
+}
+
+static bool gzip_compress(const char* in, size_t len, char* out, size_t& out_len){
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    //windowBits加16输出gzip格式而不是zlib格式
+    if (deflateInit2(&stream, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    stream.next_in = (Bytef*)in;
+    stream.avail_in = len;
+    stream.next_out = (Bytef*)out;
+    stream.avail_out = out_len;
+    int ret = deflate(&stream, Z_FINISH);
+    out_len = stream.total_out;
+    deflateEnd(&stream);
+    return ret == Z_STREAM_END;
+}
+
+bool compress_buffer(int encoding, const char* in, size_t len, char*& out, size_t& out_len){
+    //输出缓冲区和输入一样大，压不小就说明不值得压缩
+    out_len = len;
+    out = (char*)malloc(len > 0 ? len : 1);
+    bool ok = false;
+    if (encoding == ENCODING_GZIP) {
+        ok = gzip_compress(in, len, out, out_len);
+    } else if (encoding == ENCODING_BR) {
+        ok = BrotliEncoderCompress(BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                                   len, (const uint8_t*)in, &out_len, (uint8_t*)out) == BROTLI_TRUE;
+    }
+    if (!ok || out_len >= len) {
+        free(out);
+        out = NULL;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,23 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+
+// 响应内容编码
+enum CONTENT_ENCODING { ENCODING_IDENTITY = 0, ENCODING_GZIP, ENCODING_BR };
+
+// Content-Encoding中的名字，IDENTITY返回NULL
+const char* encoding_name(int encoding);
+// 预压缩文件的后缀（".gz"/".br"）
+const char* encoding_suffix(int encoding);
+
+// 解析Accept-Encoding，返回可接受编码的位图（1 << CONTENT_ENCODING），q=0的编码不算
+int parse_accept_encoding(const char* s, int len);
+
+// 按优先顺序（br、gzip）选出位图中的下一个编码，after为上一次的结果，没有了返回IDENTITY
+int next_encoding(int accept, int after);
+
+// 压缩in，结果用malloc分配，由调用者free。压缩后没有变小也返回false
+bool compress_buffer(int encoding, const char* in, size_t len, char*& out, size_t& out_len);
+
+#endif
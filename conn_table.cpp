@@ -0,0 +1,82 @@
+#include "conn_table.h"
+#include <atomic>
+#include <vector>
+#include "http_conn.h"
+#include "locker.h"
+
+// 一块槽位。http_conn的构造函数不初始化任何成员，块是大块内存，没用到的槽位不占物理内存
+struct conn_chunk {
+    http_conn conns[ conn_table::CHUNK_SIZE ];
+    std::atomic<uint32_t> gens[ conn_table::CHUNK_SIZE ];
+};
+
+// 块指针只增不减，查找不加锁；分配和释放槽位每个连接各一次，用一把锁保护空闲栈
+static std::atomic<conn_chunk*> chunks[ conn_table::MAX_CHUNKS ];
+static std::atomic<int> chunk_count( 0 );
+static locker table_lock;
+static std::vector<uint32_t> free_slots;   // 后进先出，刚关闭的槽位还在缓存里
+
+static inline uint64_t make_handle( uint32_t gen, uint32_t index ) {
+    return ( (uint64_t)gen << 32 ) | index;
+}
+
+http_conn* conn_table::acquire( uint64_t& handle ) {
+    table_lock.lock();
+    if ( free_slots.empty() ) {
+        int n = chunk_count.load( std::memory_order_relaxed );
+        if ( n == MAX_CHUNKS ) {
+            table_lock.unlock();
+            return NULL;
+        }
+        conn_chunk* chunk = new conn_chunk;
+        for ( int i = 0; i < CHUNK_SIZE; ++i ) {
+            chunk->gens[ i ].store( 1, std::memory_order_relaxed );
+        }
+        chunks[ n ].store( chunk, std::memory_order_release );
+        chunk_count.store( n + 1, std::memory_order_relaxed );
+        //倒着放进栈，先用下标小的
+        for ( int i = CHUNK_SIZE - 1; i >= 0; --i ) {
+            free_slots.push_back( ( n << CHUNK_BITS ) + i );
+        }
+    }
+    uint32_t index = free_slots.back();
+    free_slots.pop_back();
+    table_lock.unlock();
+
+    conn_chunk* chunk = chunks[ index >> CHUNK_BITS ].load( std::memory_order_acquire );
+    int i = index & ( CHUNK_SIZE - 1 );
+    handle = make_handle( chunk->gens[ i ].load( std::memory_order_relaxed ), index );
+    return &chunk->conns[ i ];
+}
+
+http_conn* conn_table::get( uint64_t handle ) {
+    uint32_t index = (uint32_t)handle;
+    if ( ( index >> CHUNK_BITS ) >= MAX_CHUNKS ) {
+        return NULL;
+    }
+    conn_chunk* chunk = chunks[ index >> CHUNK_BITS ].load( std::memory_order_acquire );
+    if ( !chunk ) {
+        return NULL;
+    }
+    int i = index & ( CHUNK_SIZE - 1 );
+    if ( chunk->gens[ i ].load( std::memory_order_acquire ) != (uint32_t)( handle >> 32 ) ) {
+        return NULL;
+    }
+    return &chunk->conns[ i ];
+}
+
+void conn_table::release( uint64_t handle ) {
+    uint32_t index = (uint32_t)handle;
+    conn_chunk* chunk = chunks[ index >> CHUNK_BITS ].load( std::memory_order_acquire );
+    int i = index & ( CHUNK_SIZE - 1 );
+    //代数回绕时跳过0，保证句柄的高32位非0
+    uint32_t gen = (uint32_t)( handle >> 32 ) + 1;
+    chunk->gens[ i ].store( gen ? gen : 1, std::memory_order_release );
+    table_lock.lock();
+    free_slots.push_back( index );
+    table_lock.unlock();
+}
+
+long conn_table::capacity() {
+    return (long)chunk_count.load( std::memory_order_relaxed ) * CHUNK_SIZE;
+}
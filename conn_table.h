@@ -0,0 +1,36 @@
+#ifndef CONN_TABLE_H
+#define CONN_TABLE_H
+
+#include <stdint.h>
+
+class http_conn;
+
+/*
+连接表：每个连接的http_conn放在按需分配的槽位中，和fd的数值无关。
+槽位按块（CHUNK_SIZE个）分配，块一经分配就不释放，已关闭连接的槽位放进空闲栈优先复用，
+所以占用的内存只和同时存在的连接数的峰值有关。
+
+每个槽位有一个代数，连接关闭时加一。句柄是(代数 << 32 | 槽位下标)，
+epoll的data.u64和定时器里存的都是句柄：连接关闭后残留的事件或回调用旧句柄查不到连接，
+不会落到复用了同一个fd或槽位的新连接上。代数从1开始，句柄的高32位一定非0，
+而其他fd（监听socket、管道、timerfd等）注册时data.u64就是fd本身，据此区分。
+*/
+class conn_table {
+public:
+    static const int CHUNK_BITS = 8;
+    static const int CHUNK_SIZE = 1 << CHUNK_BITS;
+    static const int MAX_CHUNKS = 4096;     // 最多CHUNK_SIZE * MAX_CHUNKS个连接
+
+    // 分配一个槽位，handle返回其句柄，连接数已达上限时返回NULL
+    static http_conn* acquire( uint64_t& handle );
+    // 句柄对应的连接，槽位已被释放（或又被复用）时返回NULL
+    static http_conn* get( uint64_t handle );
+    // 连接关闭后由关闭它的线程调用，之后不能再访问这个http_conn
+    static void release( uint64_t handle );
+    // 已分配的槽位数
+    static long capacity();
+
+    static bool is_handle( uint64_t data ) { return ( data >> 32 ) != 0; }
+};
+
+#endif
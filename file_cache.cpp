@@ -0,0 +1,247 @@
+#include "file_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include "http_header.h"
+
+file_cache::file_cache(size_t capacity) :
+    m_capacity(capacity), m_max_entry(capacity / 4), m_size(0) {
+    m_inotifyfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotifyfd == -1){
+        throw std::exception();
+    }
+}
+
+file_cache::~file_cache(){
+    std::list<cache_entry*>::iterator it;
+    for (it = m_lru.begin(); it != m_lru.end(); ++it){
+        free_entry(*it);
+    }
+    close(m_inotifyfd);
+}
+
+//同一个文件不同编码的内容分别缓存，路径中不会出现'\n'
+static std::string cache_key(const char* path, int encoding){
+    std::string key(path);
+    if (encoding != ENCODING_IDENTITY){
+        key += '\n';
+        key += encoding_name(encoding);
+    }
+    return key;
+}
+
+cache_entry* file_cache::acquire(const char* path, int encoding){
+    std::string key = cache_key(path, encoding);
+    m_lock.lock();
+    std::map<std::string, cache_entry*>::iterator it = m_entries.find(key);
+    if (it == m_entries.end()){
+        m_lock.unlock();
+        return NULL;
+    }
+    cache_entry* entry = it->second;
+    m_lru.splice(m_lru.begin(), m_lru, entry->lru_it);
+    entry->refcount++;
+    m_lock.unlock();
+    return entry;
+}
+
+cache_entry* file_cache::load(const char* path, const struct stat& st, const char* type, int encoding, bool compress){
+    if ((size_t)st.st_size > m_max_entry){
+        return NULL;
+    }
+    //之前压缩过、压不小的文件直接失败，由调用者发送原文件，不必每个请求都读一遍再压一遍
+    std::string key = cache_key(path, encoding);
+    if (compress && incompressible(key, st)){
+        return NULL;
+    }
+
+    //先加监视再读内容，读的过程中文件被修改也能收到事件。
+    //同一个inode的wd是共用的，加监视和登记正在加载要在锁内一起做，否则可能被其他线程失败时取消掉
+    m_lock.lock();
+    int wd = inotify_add_watch(m_inotifyfd, path, IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF);
+    if (wd != -1){
+        m_loading[wd]++;
+    }
+    m_lock.unlock();
+    if (wd == -1){
+        return NULL;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd == -1){
+        return abort_load(wd, NULL);
+    }
+    cache_entry* entry = new cache_entry;
+    entry->path = key;
+    entry->st = st;
+    entry->size = st.st_size;
+    entry->data = (char*) malloc(st.st_size > 0 ? st.st_size : 1);
+    off_t have_read = 0;
+    while (have_read < st.st_size){
+        ssize_t len = ::read(fd, entry->data + have_read, st.st_size - have_read);
+        if (len <= 0){
+            break;
+        }
+        have_read += len;
+    }
+    close(fd);
+    if (have_read != st.st_size){
+        return abort_load(wd, entry);
+    }
+    //压缩只做这一次，之后的请求直接使用缓存的结果
+    if (compress){
+        char* out;
+        if (!compress_buffer(encoding, entry->data, entry->size, out, entry->size)){
+            incompressible_file file;
+            file.ino = st.st_ino;
+            file.size = st.st_size;
+            file.mtime = st.st_mtim;
+            m_lock.lock();
+            if (m_incompressible.size() >= MAX_INCOMPRESSIBLE){
+                m_incompressible.clear();
+            }
+            m_incompressible[key] = file;
+            m_lock.unlock();
+            return abort_load(wd, entry);
+        }
+        free(entry->data);
+        entry->data = out;
+    }
+
+    const char* name = encoding_name(encoding);
+    entry->header_len = snprintf(entry->header, sizeof(entry->header),
+        "HTTP/1.1 200 OK\r\nContent-Length: %ld\r\nContent-Type:%s\r\n", (long)entry->size, type);
+    if (name){
+        entry->header_len += snprintf(entry->header + entry->header_len, sizeof(entry->header) - entry->header_len,
+            "Content-Encoding: %s\r\n", name);
+    }
+    entry->validators = entry->header_len;
+    entry->header_len += format_validators(st, entry->header + entry->header_len, entry->etag_len, name);
+    entry->refcount = 1;
+    entry->linked = true;
+    entry->wd = wd;
+    entry->owner = this;
+
+    m_lock.lock();
+    std::map<std::string, cache_entry*>::iterator it = m_entries.find(entry->path);
+    if (it != m_entries.end()){
+        //其他线程已经加载过了，用已有的
+        free_entry(entry);
+        finish_load(wd);
+        entry = it->second;
+        entry->refcount++;
+        m_lock.unlock();
+        return entry;
+    }
+    m_entries[entry->path] = entry;
+    m_watches.insert(std::make_pair(wd, entry));
+    finish_load(wd);
+    m_lru.push_front(entry);
+    entry->lru_it = m_lru.begin();
+    m_size += entry->size;
+    while (m_size > m_capacity && m_lru.back() != entry){
+        unlink_entry(m_lru.back());
+    }
+    m_lock.unlock();
+    return entry;
+}
+
+void file_cache::release(cache_entry* entry){
+    m_lock.lock();
+    bool dead = (--entry->refcount == 0) && !entry->linked;
+    m_lock.unlock();
+    if (dead){
+        free_entry(entry);
+    }
+}
+
+//调用时需持有m_lock
+void file_cache::unlink_entry(cache_entry* entry){
+    m_entries.erase(entry->path);
+    m_lru.erase(entry->lru_it);
+    m_size -= entry->size;
+    entry->linked = false;
+
+    //同一个inode的多个路径共用一个wd，最后一个条目移除时才取消监视
+    bool shared = false;
+    std::pair<std::multimap<int, cache_entry*>::iterator, std::multimap<int, cache_entry*>::iterator> range = m_watches.equal_range(entry->wd);
+    for (std::multimap<int, cache_entry*>::iterator it = range.first; it != range.second; ){
+        if (it->second == entry){
+            m_watches.erase(it++);
+        } else {
+            shared = true;
+            ++it;
+        }
+    }
+    if (!shared && m_loading.find(entry->wd) == m_loading.end()){
+        inotify_rm_watch(m_inotifyfd, entry->wd);
+    }
+    if (entry->refcount == 0){
+        free_entry(entry);
+    }
+}
+
+//key对应的文件压缩过但压不小，且之后没有变化
+bool file_cache::incompressible(const std::string& key, const struct stat& st){
+    m_lock.lock();
+    std::map<std::string, incompressible_file>::iterator it = m_incompressible.find(key);
+    bool same = it != m_incompressible.end() && it->second.ino == st.st_ino && it->second.size == st.st_size
+        && it->second.mtime.tv_sec == st.st_mtim.tv_sec && it->second.mtime.tv_nsec == st.st_mtim.tv_nsec;
+    if (it != m_incompressible.end() && !same){
+        m_incompressible.erase(it);     //文件变了，重新尝试
+    }
+    m_lock.unlock();
+    return same;
+}
+
+//一次加载结束（调用时需持有m_lock）。没有条目使用、也没有其他线程在加载时取消监视，
+//否则读取失败的文件会一直占着inotify的监视数
+void file_cache::finish_load(int wd){
+    std::map<int, int>::iterator it = m_loading.find(wd);
+    if (--it->second > 0){
+        return;
+    }
+    m_loading.erase(it);
+    if (m_watches.find(wd) == m_watches.end()){
+        inotify_rm_watch(m_inotifyfd, wd);
+    }
+}
+
+//加载失败：释放读了一半的条目，返回NULL
+cache_entry* file_cache::abort_load(int wd, cache_entry* entry){
+    if (entry){
+        free_entry(entry);
+    }
+    m_lock.lock();
+    finish_load(wd);
+    m_lock.unlock();
+    return NULL;
+}
+
+void file_cache::free_entry(cache_entry* entry){
+    free(entry->data);
+    delete entry;
+}
+
+void file_cache::handle_inotify(){
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    while (true) {
+        ssize_t len = ::read(m_inotifyfd, buf, sizeof(buf));
+        if (len <= 0){
+            break;
+        }
+        m_lock.lock();
+        for (char* ptr = buf; ptr < buf + len; ){
+            struct inotify_event* event = (struct inotify_event*) ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+            //该wd上的所有条目都失效
+            std::multimap<int, cache_entry*>::iterator it;
+            while ((it = m_watches.find(event->wd)) != m_watches.end()){
+                unlink_entry(it->second);
+            }
+        }
+        m_lock.unlock();
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>
+#include <string>
+#include <list>
+#include <map>
+#include "locker.h"
+#include "compress.h"
+
+class file_cache;
+
+//缓存的一个文件：文件内容、元数据和预先生成好的响应头（状态行、Content-Length、Content-Type、ETag、Last-Modified）
+struct cache_entry {
+    std::string path;   //缓存的键，压缩过的内容为"路径\n编码"
+    char* data;
+    size_t size;        //data的长度，压缩过的内容小于st.st_size
+    struct stat st;
+    char header[256];
+    int header_len;
+    int validators;     //ETag和Last-Modified两行在header中的起始位置，304响应直接复用
+    int etag_len;       //ETag的值从header + validators + ETAG.len开始
+    int refcount;       //正在使用该条目的连接数，为0且已移出缓存时才释放
+    bool linked;        //是否还在缓存中
+    int wd;             //inotify监视描述符
+    file_cache* owner;  //条目所属的缓存，用完后交给它release
+    std::list<cache_entry*>::iterator lru_it;
+};
+
+/*
+所有工作线程共享的静态文件缓存，按文件路径索引，总大小受capacity限制，超出时按LRU淘汰。
+命中时不需要stat/open/mmap，直接用缓存的内容和响应头。
+每个缓存的文件都加了inotify监视，文件被修改、删除或移动后由主线程处理inotify事件使其失效。
+条目有引用计数，淘汰或失效时仍在发送的连接可以继续安全地使用它。
+*/
+class file_cache {
+public:
+    file_cache(size_t capacity);
+    ~file_cache();
+
+    //查找并占用一个条目，未命中返回NULL。encoding为文件内容的编码
+    cache_entry* acquire(const char* path, int encoding = ENCODING_IDENTITY);
+    /*
+    读入文件并加入缓存，返回已占用的条目；文件过大、读取或压缩失败返回NULL。
+    type为Content-Type。encoding不是IDENTITY时，compress为true表示把文件压缩后缓存，
+    否则表示文件本身就是该编码的预压缩文件（.gz/.br）
+    */
+    cache_entry* load(const char* path, const struct stat& st, const char* type,
+                      int encoding = ENCODING_IDENTITY, bool compress = false);
+    //释放acquire/load得到的条目
+    void release(cache_entry* entry);
+
+    int get_inotify_fd() { return m_inotifyfd; }
+    //读取inotify事件并使对应条目失效
+    void handle_inotify();
+
+private:
+    void unlink_entry(cache_entry* entry);
+    void finish_load(int wd);
+    cache_entry* abort_load(int wd, cache_entry* entry);
+    bool incompressible(const std::string& key, const struct stat& st);
+    static void free_entry(cache_entry* entry);
+
+private:
+    size_t m_capacity;
+    size_t m_max_entry;     //单个文件的大小上限
+    size_t m_size;
+    int m_inotifyfd;
+    std::map<std::string, cache_entry*> m_entries;
+    std::multimap<int, cache_entry*> m_watches;
+    std::map<int, int> m_loading;   //已加监视、正在读取的文件的wd和加载数，期间不能取消监视
+    //压不小的文件（键同m_entries），记下当时的inode、大小和修改时间，文件没变之前不再尝试压缩
+    struct incompressible_file {
+        ino_t ino;
+        off_t size;
+        struct timespec mtime;
+    };
+    static const size_t MAX_INCOMPRESSIBLE = 4096;  //超过时整个清空，只是少了一次快速失败
+    std::map<std::string, incompressible_file> m_incompressible;
+    std::list<cache_entry*> m_lru;  //头部最近使用
+    locker m_lock;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "http_body.h"
+#include <stdio.h>
+#include <string.h>
+
+bool upload_stat_handler::on_data(post_context&, const char*, int){
+    return true;
+}
+
+void upload_stat_handler::on_end(post_context& ctx){
+    char buf[128];
+    snprintf(buf, sizeof(buf), "received %ld bytes%s\n", ctx.received, ctx.content_length < 0 ? " (chunked)" : "");
+    ctx.reply = buf;
+}
+
+const char* status_title(int status){
+    switch (status) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 411: return "Length Required";
+        case 413: return "Content Too Large";
+        case 415: return "Unsupported Media Type";
+        case 500: return "Internal Error";
+        case 501: return "Not Implemented";
+        case 503: return "Service Unavailable";
+        default: return "Unknown";
+    }
+}
+
+void chunked_decoder::reset(){
+    m_state = SIZE;
+    m_remaining = 0;
+}
+
+//buf中以"\r\n"结尾的一行的长度（含"\r\n"），不完整返回0，过长或只有'\n'返回-1
+static int chunk_line(const char* buf, int len){
+    int limit = len < chunked_decoder::MAX_LINE ? len : chunked_decoder::MAX_LINE;
+    const char* lf = (const char*)memchr(buf, '\n', limit);
+    if (!lf){
+        return len < chunked_decoder::MAX_LINE ? 0 : -1;
+    }
+    if (lf == buf || lf[-1] != '\r'){
+        return -1;
+    }
+    return lf - buf + 1;
+}
+
+int chunked_decoder::next(const char* buf, int len, const char*& data, int& data_len){
+    data_len = 0;
+    switch (m_state) {
+        case SIZE: {
+            //块大小（十六进制）[;扩展]\r\n
+            int line = chunk_line(buf, len);
+            if (line <= 0){
+                return line;
+            }
+            long size = 0;
+            int i = 0;
+            for (; i < line - 2; ++i){
+                char c = buf[i];
+                int digit;
+                if (c >= '0' && c <= '9'){
+                    digit = c - '0';
+                } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f'){
+                    digit = (c | 0x20) - 'a' + 10;
+                } else {
+                    break;
+                }
+                if (size > (1L << 40)){
+                    return -1;
+                }
+                size = size * 16 + digit;
+            }
+            if (i == 0 || (i < line - 2 && buf[i] != ';' && buf[i] != ' ' && buf[i] != '\t')){
+                return -1;
+            }
+            m_remaining = size;
+            m_state = size ? DATA : TRAILER;
+            return line;
+        }
+        case DATA: {
+            int n = m_remaining < len ? m_remaining : len;
+            data = buf;
+            data_len = n;
+            m_remaining -= n;
+            if (m_remaining == 0){
+                m_state = DATA_END;
+            }
+            return n;
+        }
+        case DATA_END: {
+            if (len < 2){
+                return 0;
+            }
+            if (buf[0] != '\r' || buf[1] != '\n'){
+                return -1;
+            }
+            m_state = SIZE;
+            return 2;
+        }
+        case TRAILER: {
+            //trailer的各行以空行结束
+            int line = chunk_line(buf, len);
+            if (line == 2){
+                m_state = DONE;
+            }
+            return line;
+        }
+        default:
+            return 0;
+    }
+}
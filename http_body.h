@@ -0,0 +1,78 @@
+#ifndef HTTP_BODY_H
+#define HTTP_BODY_H
+
+#include <string>
+
+/*
+请求体的流式处理：POST的消息体（Content-Length或chunked）按到达的顺序分段交给处理函数，
+连接只保留一个有界的读缓冲区，上传再大也不需要缓存整个消息体。
+*/
+
+class http_conn;
+
+// 一个POST请求的处理上下文，处理函数的各个回调之间通过它传递状态
+struct post_context {
+    http_conn* conn;        // 可以用get_header读取请求头部
+    const char* url;        // 请求的url，只在请求处理期间有效
+    long content_length;    // chunked时为-1
+    long received;          // 已交给处理函数的请求体字节数
+    void* state;            // 处理函数自己的状态
+    int status;             // 响应的状态码，默认200
+    std::string reply;      // 响应内容（text/html）
+};
+
+/*
+POST请求的处理函数，用route_table::add_post注册，所有连接共用一个对象，每个请求的状态放在post_context中。
+一个请求依次调用on_begin、若干次on_data，最后调用on_end或on_abort中的一个。
+on_begin/on_data返回false表示拒绝或中止请求，随后调用on_abort，
+用ctx.status和ctx.reply回复并关闭连接（剩余的请求体不再读取）。
+请求体格式错误或连接中途关闭时也调用on_abort。
+*/
+class post_handler {
+public:
+    virtual ~post_handler() {}
+    // 头部完整后调用，请求体还没有开始接收
+    virtual bool on_begin(post_context&) { return true; }
+    // 收到一段请求体
+    virtual bool on_data(post_context& ctx, const char* data, int len) = 0;
+    // 请求体接收完毕，在ctx中填写响应
+    virtual void on_end(post_context& ctx) = 0;
+    // 释放ctx.state
+    virtual void on_abort(post_context&) {}
+};
+
+// 示例：统计请求体的字节数并回复，可以用来测试上传
+class upload_stat_handler : public post_handler {
+public:
+    virtual bool on_data(post_context& ctx, const char* data, int len);
+    virtual void on_end(post_context& ctx);
+};
+
+// 响应状态码的原因短语
+const char* status_title(int status);
+
+/*
+chunked消息体的解码器。输入可以在任意位置断开：不完整的块大小行/结束行不消耗，
+等更多数据到达后从同一位置再调用。块扩展和trailer都忽略
+*/
+class chunked_decoder {
+public:
+    static const int MAX_LINE = 1024;   //块大小行和trailer行的长度上限
+
+    // 没有构造函数，http_conn数组分配时不会写到每个连接的这部分内存，使用前先reset
+    void reset();
+    /*
+    从buf[0, len)解码，遇到数据时在data/data_len中返回一段并停止（否则data_len为0）。
+    返回消耗的字节数，0表示需要更多数据，-1表示格式错误
+    */
+    int next(const char* buf, int len, const char*& data, int& data_len);
+    // 最后一个块和trailer都已解码，之后的字节属于下一个请求
+    bool done() const { return m_state == DONE; }
+
+private:
+    enum STATE { SIZE, DATA, DATA_END, TRAILER, DONE };
+    STATE m_state;
+    long m_remaining;   // 当前块还没有解码的字节数
+};
+
+#endif
@@ -1,10 +1,21 @@
 #include "http_conn.h"
+#include <sys/sendfile.h>
+#include <sched.h>
+#include "admission.h"
 
 // 网站的根目录
 const char* doc_root = "/root/newcoder/webserver/resourses";
 
-int http_conn:: m_epollfd = -1; 
-int http_conn::m_user_count = 0;  
+std::atomic<int> http_conn::m_user_count(0);
+bool http_conn::m_et = false;
+long http_conn::m_sendfile_threshold = -1;
+file_cache* http_conn::m_file_cache = NULL;
+bool http_conn::m_compress = false;
+file_cache* http_conn::m_encoded_cache = NULL;
+route_table* http_conn::m_routes = NULL;
+int http_conn::m_max_age = -1;
+
+static const char* method_names[] = { "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT" };
 
 const char* ok_200_title = "OK";
 const char* error_400_title = "Bad Request";
@@ -23,29 +34,49 @@ int setnonblocking(int fd){
     return old_flag;
 }
 
-void addfd(int epollfd, int fd, bool one_shot){
+//one_shot保证一个socket同一时刻只被一个线程处理，et为边沿触发。
+//data.u64就是fd，高32位为0，和连接的句柄区分开
+void addfd(int epollfd, int fd, bool one_shot, bool et){
     epoll_event event;  
-    event.events = EPOLLIN  | EPOLLRDHUP;  //| EPOLLET
-    event.data.fd = fd;
+    event.events = EPOLLIN  | EPOLLRDHUP;
+    event.data.u64 = fd;
 
     if (one_shot){
-        event.events | EPOLLONESHOT;  
+        event.events |= EPOLLONESHOT;  
+    }
+    if (et){
+        event.events |= EPOLLET;
     }
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
     setnonblocking(fd);
 
 }
 
+//注册连接socket，data是连接的句柄
+void addconn(int epollfd, int fd, uint64_t handle, bool et){
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.u64 = handle;
+    if (et){
+        event.events |= EPOLLET;
+    }
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+}
+
 //移除
 void removefd(int epollfd, int fd){
     epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
     close(fd);
 }
 
-void modfd(int epollfd, int fd, int ev){
+//重置EPOLLONESHOT，让socket下一次就绪时能再次触发
+void modfd(int epollfd, int fd, uint64_t handle, int ev, bool et){
     epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = handle;
     event.events = ev | EPOLLONESHOT | EPOLLRDHUP;
+    if (et){
+        event.events |= EPOLLET;
+    }
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event); 
 }
 
@@ -53,19 +84,52 @@ int http_conn::getfd(){
     return this->m_sockfd;
 }
 
-void http_conn::init(int sockfd, const sockaddr_in & addr){
+http_conn::CONN_PHASE http_conn::phase(){
+    if (m_read_idx == 0){
+        return PHASE_IDLE;
+    }
+    if (m_check_state == CHECK_STATE_CONTENT){
+        return PHASE_BODY;
+    }
+    return PHASE_HEADER;
+}
+
+void http_conn::init(int sockfd, const sockaddr_in & addr, int epollfd, uint64_t handle){
+    m_epollfd = epollfd;
     m_sockfd = sockfd;
     m_address = addr;
+    m_handle = handle;
 
     int reuse = 1;
     setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
-    addfd(m_epollfd, sockfd, true);
+    m_owner.store(OWNER_REACTOR, std::memory_order_relaxed);
+    addconn(m_epollfd, sockfd, m_handle, m_et);
     m_user_count++;  
+    m_file_address = 0;
+    m_file_fd = -1;
+    m_cache_entry = NULL;
+    m_post_handler = NULL;
+    m_post = NULL;
+    m_read_buf = NULL;
+    m_read_size = 0;
+    m_write_buf = NULL;
+    m_write_size = 0;
+    m_batch = NULL;
+    m_batch_size = 0;
+    m_response_count = 0;
+    m_part_count = 0;
+    m_iv_count = 0;
+    m_iv_idx = 0;
+    m_request_start = 0;
+    m_batch_linger = false;
+    worker = -1;
+    queued_at = 0;
+    m_send_start = 0;
     init(); 
 }
 
-//初始化解析客户端请求的状态设置
+//初始化解析客户端请求的状态设置。缓冲区不清零，所有读写都以下标为界
 void http_conn::init(){
 
     bytes_to_send = 0;
@@ -78,34 +142,187 @@ void http_conn::init(){
     m_url = 0;
     m_version = 0;
     m_content_length = 0;  
-    m_host = 0;
+    m_chunked = false;
+    m_header_count = 0;
+    m_range_count = 0;
+    memset(m_header_index, -1, sizeof(m_header_index));
+    m_body_start = 0;
 
     m_checked_index = 0; 
     m_start_line = 0; 
     m_read_idx = 0; 
     m_write_idx = 0;
-    
-    bzero(m_read_buf, READ_BUFFER_SIZE);  
-    bzero(m_write_buf, READ_BUFFER_SIZE);
-    bzero(m_real_file, FILENAME_LEN);
+    m_real_file[0] = '\0';
+}
+
+//读写缓冲区和批次状态归还给buffer_pool
+void http_conn::release_buffers(){
+    if (m_batch){
+        buffer_pool::release((char*)m_batch, m_batch_size);
+        m_batch = NULL;
+        m_batch_size = 0;
+    }
+    if (m_read_buf){
+        buffer_pool::release(m_read_buf, m_read_size);
+        m_read_buf = NULL;
+        m_read_size = 0;
+    }
+    if (m_write_buf){
+        buffer_pool::release(m_write_buf, m_write_size);
+        m_write_buf = NULL;
+        m_write_size = 0;
+    }
+}
+
+//工作线程开始处理时借一块批次状态，直到连接空闲才归还，期间已解析的头部和待发送的响应都在里面
+bool http_conn::acquire_batch(){
+    if (m_batch){
+        return true;
+    }
+    int size = sizeof(batch_state);
+    char* buf = buffer_pool::acquire(size);
+    if (!buf){
+        return false;
+    }
+    m_batch = (batch_state*)buf;
+    m_batch_size = size;
+    return true;
 }
 
+//读缓冲区满了换大一档的，已读入的数据和解析到一半的指针一起搬过去
+bool http_conn::grow_read_buf(){
+    int size = m_read_size ? m_read_size * 2 : buffer_pool::MIN_SIZE;
+    char* buf = buffer_pool::acquire(size);
+    if (!buf){
+        return false;
+    }
+    if (m_read_buf){
+        memcpy(buf, m_read_buf, m_read_idx);
+        if (m_url) m_url = buf + (m_url - m_read_buf);
+        if (m_version) m_version = buf + (m_version - m_read_buf);
+        if (m_post) m_post->url = m_url;
+        buffer_pool::release(m_read_buf, m_read_size);
+    }
+    m_read_buf = buf;
+    m_read_size = size;
+    return true;
+}
+
+//当前请求的头部是否已经完整地在读缓冲区中（解析到的位置之后有空行）
+bool http_conn::header_received(){
+    if (m_check_state == CHECK_STATE_CONTENT){
+        return false;   //流式接收的请求体由BODY_WINDOW控制，其余的请求体要整个放进缓冲区
+    }
+    const char* start = m_read_buf + m_start_line;
+    int len = m_read_idx - m_start_line;
+    //已解析的头部行的"\r\n"被改写成了'\0'，空行可能紧接在已解析的部分之后
+    if (m_check_state == CHECK_STATE_HEADER && len >= 2 && start[0] == '\r' && start[1] == '\n'){
+        return true;
+    }
+    return memmem(start, len, "\r\n\r\n", 4) != NULL;
+}
+
+//保证写缓冲区还能再写入len字节，不够时换大一档的
+bool http_conn::reserve_write(int len){
+    if (m_write_size - m_write_idx >= len){
+        return true;
+    }
+    int size = m_write_idx + len;
+    if (size < buffer_pool::MIN_SIZE){
+        size = buffer_pool::MIN_SIZE;
+    }
+    char* buf = buffer_pool::acquire(size);
+    if (!buf){
+        return false;
+    }
+    if (m_write_buf){
+        memcpy(buf, m_write_buf, m_write_idx);
+        buffer_pool::release(m_write_buf, m_write_size);
+    }
+    m_write_buf = buf;
+    m_write_size = size;
+    return true;
+}
+
+//由连接的所有者调用：reactor线程，或者OWNER_CLOSING状态下的工作线程
 void http_conn::close_conn(){
     if (m_sockfd != -1){
-        removefd(m_epollfd, m_sockfd);
+        int sockfd = m_sockfd;
+        abort_post();
+        delete m_post;
+        m_post = NULL;
+        unmap();  //发送到一半被关闭时释放文件映射/文件描述符
+        release_buffers();
+        removefd(m_epollfd, sockfd);
         m_sockfd = -1;
+        m_owner.store(OWNER_NONE, std::memory_order_relaxed);
         m_user_count--;  
+        admission::release_ip(m_address.sin_addr.s_addr);
+        //最后才释放槽位，之后它可能马上被其他reactor分配给新连接
+        conn_table::release(m_handle);
     }
 }
 
-bool http_conn::read(){
-    if (m_read_idx >= READ_BUFFER_SIZE){
+//reactor收到事件时确认连接归自己。工作线程正在重新注册时事件可能先到，等它交还，很快就会结束
+bool http_conn::owned_by_reactor(){
+    int owner;
+    while ((owner = m_owner.load(std::memory_order_acquire)) == OWNER_REARM){
+        sched_yield();
+    }
+    return owner == OWNER_REACTOR;
+}
+
+bool http_conn::expire(){
+    int owner = OWNER_WORKER;
+    if (m_owner.compare_exchange_strong(owner, OWNER_CLOSING, std::memory_order_acq_rel)){
+        return false;
+    }
+    if (owner == OWNER_REARM && m_owner.compare_exchange_strong(owner, OWNER_CLOSING, std::memory_order_acq_rel)){
         return false;
     }
+    return owner == OWNER_REACTOR;
+}
 
+//工作线程处理完，重新注册ev后把连接交还reactor。交还之后不能再访问连接的任何成员
+void http_conn::hand_back(int ev){
+    int owner = OWNER_WORKER;
+    if (m_owner.compare_exchange_strong(owner, OWNER_REARM, std::memory_order_acq_rel)){
+        modfd(m_epollfd, m_sockfd, m_handle, ev, m_et);
+        owner = OWNER_REARM;
+        if (m_owner.compare_exchange_strong(owner, OWNER_REACTOR, std::memory_order_release, std::memory_order_acquire)){
+            return;
+        }
+    }
+    //处理期间超时了，定时器已经删除，由工作线程关闭。已注册的事件到达reactor时查不到这个连接
+    close_conn();
+}
+
+//工作线程中出错要关闭连接。定时器属于reactor线程，这里不能删除它，
+//所以只shutdown，交还后reactor收到EPOLLRDHUP/EPOLLHUP时再关闭
+void http_conn::worker_close(){
+    shutdown(m_sockfd, SHUT_RDWR);
+    hand_back(EPOLLIN);
+}
+
+//循环读取直到EAGAIN，ET模式下必须一次读完。缓冲区满了就扩大，超过上限时关闭连接
+bool http_conn::read(){
     int bytes_read = 0;
     while (true) {  
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        if (m_read_idx == m_read_size){
+            //流式接收请求体时缓冲区不再扩大，先交给工作线程处理已收到的部分，处理完重新注册EPOLLIN后接着读
+            if (m_post_handler && m_check_state == CHECK_STATE_CONTENT && m_read_size - m_body_start >= BODY_WINDOW){
+                break;
+            }
+            if (!grow_read_buf()){
+                //头部和请求体一起到达时，工作线程还没进入流式接收。头部已经完整就先交给它处理，
+                //处理完腾出缓冲区后接着读；头部本身超过上限才关闭
+                if (m_read_idx > 0 && header_received()){
+                    break;
+                }
+                return false;
+            }
+        }
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_size - m_read_idx, 0);
         if (bytes_read == -1){
             if (errno == EAGAIN || errno == EWOULDBLOCK){
                 break;
@@ -127,7 +344,9 @@ http_conn::HTTP_CODE http_conn::process_read(){
     || (line_status = parse_line()) == LINE_OK) {  
         text = getline();
         m_start_line = m_checked_index;  
-        printf("got 1 http line : %s \n", text);
+        if (m_check_state != CHECK_STATE_CONTENT){  //请求体不是以'\0'结尾的行
+            LOG_DEBUG("got 1 http line : %s", text);
+        }
         switch(m_check_state){
             case CHECK_STATE_REQUESTLINE:{
                 ret = parse_request_line(text);
@@ -139,20 +358,20 @@ http_conn::HTTP_CODE http_conn::process_read(){
             }
             case CHECK_STATE_HEADER: {
                 ret = parse_headers(text);
-                if (ret == BAD_REQUEST){
-                    return BAD_REQUEST;  
-                } else if (ret == GET_REQUEST){    
+                if (ret == GET_REQUEST){    
                     return do_request(); 
+                } else if (ret != NO_REQUEST){
+                    return ret;  //错误，或POST请求不需要再接收请求体
                 }
                 break;
             }
             case CHECK_STATE_CONTENT: {
-                ret = parse_content(text);
+                ret = m_method == POST ? read_post_body() : parse_content(text);
                 if (ret == GET_REQUEST){
                     return do_request();
                 }
-                line_status = LINE_OPEN;  
-                break;
+                //请求体还没有收完。不能再回到循环条件里的parse_line，它会把请求体中的"\r\n"当作行尾改写
+                return ret;
             }
             default: {
                 return INTERNAL_ERROR; 
@@ -173,6 +392,8 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char * text) {
     char* method = text;
     if (strcasecmp(method, "GET") == 0){  
         m_method = GET;
+    } else if (strcasecmp(method, "POST") == 0){
+        m_method = POST;
     } else {
         return BAD_REQUEST;
     }
@@ -201,44 +422,226 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char * text) {
 
 http_conn::HTTP_CODE http_conn::parse_headers(char * text) { 
     if( text[0] == '\0' ) {
+        if ( m_chunked && m_content_length != 0 ) {
+            return BAD_REQUEST;     //两者同时出现时无法确定请求体的边界
+        }
+        if ( m_method == POST ) {
+            return begin_post();
+        }
+        if ( m_chunked ) {
+            return BAD_REQUEST;     //GET的请求体只按Content-Length跳过
+        }
         if ( m_content_length != 0 ) {
             m_check_state = CHECK_STATE_CONTENT;
             return NO_REQUEST;
         }
         return GET_REQUEST;
-    } else if ( strncasecmp( text, "Connection:", 11 ) == 0 ) {
-        //Connection: keep-alive
-        text += 11;
-        text += strspn( text, " \t" );  
-        if ( strcasecmp( text, "keep-alive" ) == 0 ) {
-            m_linger = true;
-        }
-    } else if ( strncasecmp( text, "Content-Length:", 15 ) == 0 ) {
-        text += 15;
-        text += strspn( text, " \t" );
-        m_content_length = atol(text);
-    } else if ( strncasecmp( text, "Host:", 5 ) == 0 ) {
-        text += 5;
-        text += strspn( text, " \t" );
-        m_host = text;
-    } else {
-        printf( "oop! unknow header %s\n", text );
+    }
+    char* colon = strchr( text, ':' );
+    if ( !colon ) {
+        return NO_REQUEST;
+    }
+    if ( m_header_count == MAX_HEADERS ) {
+        return BAD_REQUEST;
+    }
+    //名称和值都只记录位置，值去掉两端的空白
+    char* value = colon + 1 + strspn( colon + 1, " \t" );
+    int value_len = strlen( value );
+    while ( value_len > 0 && ( value[ value_len - 1 ] == ' ' || value[ value_len - 1 ] == '\t' ) ) {
+        --value_len;
+    }
+    //按冒号前的名称查表分类，不再逐个strncasecmp
+    HEADER_ID id = header_lookup( text, colon - text );
+    header_field& field = m_batch->headers[ m_header_count ];
+    field.id = id;
+    field.name = text - m_read_buf;
+    field.name_len = colon - text;
+    field.value = value - m_read_buf;
+    field.value_len = value_len;
+    if ( id != HDR_UNKNOWN && m_header_index[ id ] < 0 ) {
+        m_header_index[ id ] = m_header_count;
+    }
+    m_header_count++;
+
+    switch ( id ) {
+        case HDR_CONNECTION:
+            //Connection: keep-alive
+            if ( value_len == 10 && strncasecmp( value, "keep-alive", 10 ) == 0 ) {
+                m_linger = true;
+            }
+            break;
+        case HDR_CONTENT_LENGTH: {
+            char* end;
+            m_content_length = strtol( value, &end, 10 );
+            if ( end == value || end != value + value_len || m_content_length < 0 ) {
+                return BAD_REQUEST;
+            }
+            break;
+        }
+        case HDR_TRANSFER_ENCODING:
+            //只支持单独的chunked，其他编码无法解开
+            if ( value_len != 7 || strncasecmp( value, "chunked", 7 ) != 0 ) {
+                return BAD_REQUEST;
+            }
+            m_chunked = true;
+            break;
+        default:
+            break;
     }
     return NO_REQUEST;
 }
 
+bool http_conn::get_header( HEADER_ID id, str_view& value ) {
+    int i = m_header_index[ id ];
+    if ( i < 0 ) {
+        return false;
+    }
+    value.data = m_read_buf + m_batch->headers[ i ].value;
+    value.len = m_batch->headers[ i ].value_len;
+    return true;
+}
+
+bool http_conn::get_header( const char* name, str_view& value ) {
+    int len = strlen( name );
+    HEADER_ID id = header_lookup( name, len );
+    if ( id != HDR_UNKNOWN ) {
+        return get_header( id, value );
+    }
+    for ( int i = 0; i < m_header_count; ++i ) {
+        const header_field& field = m_batch->headers[ i ];
+        if ( field.name_len == len && strncasecmp( m_read_buf + field.name, name, len ) == 0 ) {
+            value.data = m_read_buf + field.value;
+            value.len = field.value_len;
+            return true;
+        }
+    }
+    return false;
+}
+
 // 没有真正解析HTTP请求的消息体，只是判断它是否被完整的读入了
-http_conn::HTTP_CODE http_conn::parse_content( char* text ) {
+http_conn::HTTP_CODE http_conn::parse_content( char* ) {
+    //消息体后面可能紧跟着流水线中的下一个请求，不能在末尾写'\0'
     if ( m_read_idx >= ( m_content_length + m_checked_index ) ) {
-        text[ m_content_length ] = '\0';
         return GET_REQUEST;
     }
     return NO_REQUEST;
 }
 
+//POST请求的头部已完整：找到处理函数，有请求体时进入流式接收
+http_conn::HTTP_CODE http_conn::begin_post(){
+    m_route = m_routes ? m_routes->find( m_url, m_route_matched ) : NULL;
+    post_handler* handler = m_route ? m_route->post : NULL;
+    if ( !handler ) {
+        m_linger = false;   //请求体没有读取，无法确定下一个请求从哪里开始
+        return m_route ? METHOD_NOT_ALLOWED : NO_RESOURCE;
+    }
+    //上下文在连接第一次收到POST时才分配，之后复用
+    if ( !m_post ) {
+        m_post = new post_context;
+    }
+    m_post->conn = this;
+    m_post->url = m_url;
+    m_post->content_length = m_chunked ? -1 : m_content_length;
+    m_post->received = 0;
+    m_post->state = NULL;
+    m_post->status = 200;
+    m_post->reply.clear();
+    m_post_handler = handler;
+    if ( !handler->on_begin( *m_post ) ) {
+        abort_post();
+        m_linger = false;
+        return POST_REQUEST;
+    }
+    if ( !m_chunked && m_content_length == 0 ) {
+        m_post_handler = NULL;
+        handler->on_end( *m_post );
+        return POST_REQUEST;
+    }
+
+    //客户端等待100 Continue才发送请求体。前面还有没发出的响应时不能插到它们前面，客户端等待超时后也会发送
+    str_view expect;
+    if ( m_response_count == 0 && get_header( HDR_EXPECT, expect )
+        && expect.len == 12 && strncasecmp( expect.data, "100-continue", 12 ) == 0 ) {
+        static const char continue_100[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        send( m_sockfd, continue_100, sizeof( continue_100 ) - 1, MSG_NOSIGNAL );
+    }
+    m_body_left = m_content_length;
+    m_body_start = m_checked_index;
+    m_chunked_decoder.reset();
+    m_check_state = CHECK_STATE_CONTENT;
+    return NO_REQUEST;
+}
+
+/*
+把读缓冲区中已到达的请求体交给处理函数，然后从缓冲区中移除，
+读缓冲区只需容纳头部和BODY_WINDOW大小的一段请求体。请求体结束返回POST_REQUEST
+*/
+http_conn::HTTP_CODE http_conn::read_post_body(){
+    bool done = false;
+    while ( !done && m_checked_index < m_read_idx ) {
+        const char* data = m_read_buf + m_checked_index;
+        int avail = m_read_idx - m_checked_index;
+        int data_len;
+        if ( m_chunked ) {
+            int n = m_chunked_decoder.next( data, avail, data, data_len );
+            if ( n < 0 ) {
+                abort_post();
+                return BAD_REQUEST;
+            }
+            if ( n == 0 ) {
+                break;
+            }
+            m_checked_index += n;
+            done = m_chunked_decoder.done();
+        } else {
+            data_len = m_body_left < avail ? m_body_left : avail;
+            m_body_left -= data_len;
+            m_checked_index += data_len;
+            done = m_body_left == 0;
+        }
+        if ( data_len > 0 ) {
+            m_post->received += data_len;
+            if ( !m_post_handler->on_data( *m_post, data, data_len ) ) {
+                abort_post();
+                m_linger = false;
+                return POST_REQUEST;
+            }
+        }
+    }
+
+    //已处理的请求体移出缓冲区，后面可能紧跟着流水线中的下一个请求
+    int consumed = m_checked_index - m_body_start;
+    if ( consumed > 0 ) {
+        memmove( m_read_buf + m_body_start, m_read_buf + m_checked_index, m_read_idx - m_checked_index );
+        m_read_idx -= consumed;
+        m_checked_index = m_start_line = m_body_start;
+    }
+    if ( !done ) {
+        return NO_REQUEST;
+    }
+    post_handler* handler = m_post_handler;
+    m_post_handler = NULL;
+    handler->on_end( *m_post );
+    return POST_REQUEST;
+}
+
+//请求没有正常结束时让处理函数释放它的状态，状态码没有设置时按请求错误回复
+void http_conn::abort_post(){
+    if ( m_post_handler ) {
+        post_handler* handler = m_post_handler;
+        m_post_handler = NULL;
+        handler->on_abort( *m_post );
+        if ( m_post->status == 200 ) {
+            m_post->status = 400;
+        }
+    }
+}
+
 http_conn::LINE_STATUS http_conn::parse_line(){ 
     char temp;
-    for ( ; m_checked_index < m_read_idx; ++m_checked_index){
+    //用向量指令直接跳到下一个'\r'或'\n'
+    m_checked_index = find_line_end(m_read_buf, m_checked_index, m_read_idx);
+    if (m_checked_index < m_read_idx){
         temp = m_read_buf[m_checked_index];
         if (temp == '\r'){
             if ((m_checked_index + 1) == m_read_idx){  
@@ -262,10 +665,43 @@ http_conn::LINE_STATUS http_conn::parse_line(){
 }
 
 http_conn::HTTP_CODE http_conn::do_request(){
+    m_lookup_start = metrics::now();
+    //动态接口优先，没有匹配的路由时才按静态文件处理
+    if ( m_routes && ( m_route = m_routes->find( m_url, m_route_matched ) ) ) {
+        return m_route->get ? ROUTE_REQUEST : METHOD_NOT_ALLOWED;
+    }
+
     // "/home/nowcoder/webserver/resources"
-    strcpy( m_real_file, doc_root );   
-    int len = strlen( doc_root );
-    strncpy( m_real_file + len, m_url, FILENAME_LEN - len - 1 );
+    static const int root_len = strlen( doc_root );
+    memcpy( m_real_file, doc_root, root_len );
+    //只拷贝url本身再补'\0'，strncpy会把剩余的空间全部填0
+    int url_len = strnlen( m_url, FILENAME_LEN - root_len - 1 );
+    memcpy( m_real_file + root_len, m_url, url_len );
+    m_real_file[ root_len + url_len ] = '\0';
+
+    //内容协商：文本类文件在客户端接受时发送br/gzip编码的内容
+    m_mime = find_mime_type( m_real_file );
+    m_encoding = ENCODING_IDENTITY;
+    m_vary = m_compress && m_mime->compressible;
+    int accept = 0;
+    str_view value;
+    if ( m_vary && get_header( HDR_ACCEPT_ENCODING, value ) ) {
+        accept = parse_accept_encoding( value.data, value.len );
+    }
+
+    //命中缓存时不需要任何文件系统调用，校验头部也是生成好的。
+    //可以压缩时只查压缩内容的缓存，未命中要先看有没有预压缩文件
+    if ( accept ) {
+        for ( int enc = next_encoding( accept, ENCODING_IDENTITY ); enc != ENCODING_IDENTITY; enc = next_encoding( accept, enc ) ) {
+            if ( m_encoded_cache && ( m_cache_entry = m_encoded_cache->acquire( m_real_file, enc ) ) ) {
+                m_encoding = enc;
+                return use_cache_entry();
+            }
+        }
+    } else if ( m_file_cache && ( m_cache_entry = m_file_cache->acquire( m_real_file ) ) ) {
+        return use_cache_entry();
+    }
+
     if ( stat( m_real_file, &m_file_stat ) < 0 ) { 
         return NO_RESOURCE;
     }
@@ -278,59 +714,337 @@ http_conn::HTTP_CODE http_conn::do_request(){
         return BAD_REQUEST;
     }
 
+    if ( accept && find_encoded( accept ) ) {
+        if ( m_cache_entry ) {
+            return use_cache_entry();
+        }
+    } else if ( m_file_cache && accept ) {
+        //有压缩内容时前面已经返回，这里是不值得压缩的文件，按原样使用普通缓存
+        if ( ( m_cache_entry = m_file_cache->acquire( m_real_file ) ) ) {
+            return use_cache_entry();
+        }
+    }
+    m_file_size = m_file_stat.st_size;
+
+    //客户端缓存的版本仍然有效时不需要打开文件
+    m_validators = m_validator_buf;
+    m_validators_len = format_validators( m_file_stat, m_validator_buf, m_etag_len, encoding_name( m_encoding ) );
+    if ( not_modified() ) {
+        return NOT_MODIFIED;
+    }
+    HTTP_CODE ret = parse_ranges();
+    if ( ret == RANGE_NOT_SATISFIABLE ) {
+        return ret;
+    }
+
+    //sendfile只能发送一段连续的文件内容，多区间的响应用映射
+    bool use_sendfile = m_sendfile_threshold >= 0 && m_file_size >= m_sendfile_threshold
+        && m_range_count <= 1;
+    if (m_file_cache && !use_sendfile){
+        m_cache_entry = m_file_cache->load(m_real_file, m_file_stat, m_mime->type, m_encoding);
+        if (m_cache_entry){
+            m_file_address = m_cache_entry->data;
+            return ret;
+        }
+    }
+
     int fd = open(m_real_file, O_RDONLY);
+    if (fd == -1){
+        return INTERNAL_ERROR;
+    }
 
-    m_file_address = (char *) mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    //大文件保留fd用sendfile发送，避免每个请求都建立/拆除映射
+    if (use_sendfile){
+        m_file_fd = fd;
+        return ret;
+    }
+    m_file_address = (char *) mmap(0, m_file_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
-    return FILE_REQUEST;  
+    return ret;  
+}
+
+/*
+找客户端接受的编码的内容，按br、gzip的顺序：
+1. 预压缩的兄弟文件（index.html.br），不比原文件旧才用。之后m_real_file和m_file_stat指向它
+2. 压缩一次后放进m_encoded_cache，m_cache_entry为占用的条目
+都没有返回false，按原样发送
+*/
+bool http_conn::find_encoded( int accept ){
+    int len = strlen( m_real_file );
+    for ( int enc = next_encoding( accept, ENCODING_IDENTITY ); enc != ENCODING_IDENTITY; enc = next_encoding( accept, enc ) ) {
+        const char* suffix = encoding_suffix( enc );
+        if ( len + strlen( suffix ) >= FILENAME_LEN ) {
+            continue;
+        }
+        strcpy( m_real_file + len, suffix );
+        struct stat st;
+        if ( stat( m_real_file, &st ) == 0 && S_ISREG( st.st_mode ) && ( st.st_mode & S_IROTH )
+            && st.st_mtime >= m_file_stat.st_mtime ) {
+            m_file_stat = st;
+            m_encoding = enc;
+            if ( m_file_cache ) {
+                m_cache_entry = m_file_cache->acquire( m_real_file, enc );
+            }
+            return true;
+        }
+        m_real_file[ len ] = '\0';
+    }
+    if ( !m_encoded_cache || m_file_stat.st_size < MIN_COMPRESS_SIZE ) {
+        return false;
+    }
+    for ( int enc = next_encoding( accept, ENCODING_IDENTITY ); enc != ENCODING_IDENTITY; enc = next_encoding( accept, enc ) ) {
+        if ( ( m_cache_entry = m_encoded_cache->load( m_real_file, m_file_stat, m_mime->type, enc, true ) ) ) {
+            m_encoding = enc;
+            return true;
+        }
+    }
+    return false;
+}
+
+//使用m_cache_entry中的内容和生成好的头部
+http_conn::HTTP_CODE http_conn::use_cache_entry(){
+    m_file_stat = m_cache_entry->st;
+    m_file_size = m_cache_entry->size;
+    m_file_address = m_cache_entry->data;
+    m_validators = m_cache_entry->header + m_cache_entry->validators;
+    m_validators_len = m_cache_entry->header_len - m_cache_entry->validators;
+    m_etag_len = m_cache_entry->etag_len;
+    return not_modified() ? NOT_MODIFIED : parse_ranges();
+}
+
+//Range请求：If-Range与当前文件一致时才按区间发送（ETag强比较或与Last-Modified相同），
+//Range格式错误或区间过多时忽略它发送整个文件
+http_conn::HTTP_CODE http_conn::parse_ranges(){
+    m_range_count = 0;
+    //区间是相对原文件的，压缩过的内容总是整个发送
+    if ( m_encoding != ENCODING_IDENTITY ) {
+        return FILE_REQUEST;
+    }
+    str_view value;
+    if ( !get_header( HDR_RANGE, value ) ) {
+        return FILE_REQUEST;
+    }
+    str_view if_range;
+    if ( get_header( HDR_IF_RANGE, if_range ) ) {
+        if ( if_range.len > 0 && if_range.data[0] == '"' ) {
+            if ( if_range.len != m_etag_len || memcmp( if_range.data, m_validators + ETAG.len, m_etag_len ) != 0 ) {
+                return FILE_REQUEST;
+            }
+        } else if ( parse_http_date( if_range.data ) != m_file_stat.st_mtime ) {
+            return FILE_REQUEST;
+        }
+    }
+    int count = parse_byte_ranges( value.data, value.len, m_file_size,
+                                   m_batch->range_start, m_batch->range_end, MAX_RANGES );
+    if ( count < 0 ) {
+        return FILE_REQUEST;
+    }
+    if ( count == 0 ) {
+        return RANGE_NOT_SATISFIABLE;
+    }
+    m_range_count = count;
+    return PARTIAL_CONTENT;
+}
+
+//条件请求：有If-None-Match时只比较ETag，否则比较If-Modified-Since
+bool http_conn::not_modified(){
+    str_view value;
+    if ( get_header( HDR_IF_NONE_MATCH, value ) ) {
+        return etag_match( value.data, value.len, m_validators + ETAG.len, m_etag_len );
+    }
+    if ( get_header( HDR_IF_MODIFIED_SINCE, value ) ) {
+        time_t since = parse_http_date( value.data );
+        return since != -1 && m_file_stat.st_mtime <= since;
+    }
+    return false;
 }
 
+//释放当前请求和本批所有待发送响应占用的文件映射/缓存条目/文件描述符
 void http_conn::unmap(){
-    if (m_file_address){
-        munmap(m_file_address, m_file_stat.st_size);
+    if (m_cache_entry){
+        m_cache_entry->owner->release(m_cache_entry);
+        m_cache_entry = NULL;
         m_file_address = 0;
+    } else if (m_file_address){
+        munmap(m_file_address, m_file_size);
+        m_file_address = 0;
+    }
+    for (int i = 0; i < m_response_count; ++i){
+        response& r = m_batch->responses[i];
+        if (r.cache){
+            r.cache->owner->release(r.cache);
+        } else if (r.file_address){
+            munmap(r.file_address, r.file_size);
+        }
+        r.cache = NULL;
+        r.file_address = 0;
+    }
+    m_response_count = 0;
+    m_part_count = 0;
+    if (m_file_fd != -1){
+        close(m_file_fd);
+        m_file_fd = -1;
     }
 }
 
+//当前请求已生成响应，解析状态指向流水线中紧跟着的下一个请求
+void http_conn::next_request(){
+    if (m_check_state == CHECK_STATE_CONTENT && m_method != POST){
+        m_checked_index += m_content_length;  //跳过消息体，POST的消息体已经交给处理函数了
+    }
+    m_request_start = m_start_line = m_checked_index;
+    m_check_state = CHECK_STATE_REQUESTLINE;
+    m_linger = false;
+    m_method = GET;
+    m_url = 0;
+    m_version = 0;
+    m_content_length = 0;
+    m_chunked = false;
+    m_header_count = 0;
+    m_range_count = 0;
+    memset(m_header_index, -1, sizeof(m_header_index));
+}
+
+//把本批响应按顺序排成iov：每个响应的头部后面跟着它的文件内容
+void http_conn::prepare_send(){
+    m_iv_count = 0;
+    m_iv_idx = 0;
+    m_file_offset = 0;
+    bytes_have_send = 0;
+    bytes_to_send = 0;
+    for (int i = 0; i < m_response_count; ++i){
+        response& r = m_batch->responses[i];
+        m_batch->iv[m_iv_count].iov_base = m_write_buf + r.header_start;
+        m_batch->iv[m_iv_count].iov_len = r.header_len;
+        m_iv_count++;
+        bytes_to_send += r.header_len;
+        for (int j = r.part_start; j < r.part_start + r.part_count; ++j){
+            body_part& part = m_batch->parts[j];
+            if (part.header_len){
+                m_batch->iv[m_iv_count].iov_base = m_write_buf + part.header_start;
+                m_batch->iv[m_iv_count].iov_len = part.header_len;
+                m_iv_count++;
+            }
+            //文件内容直接指向映射中的区间，不拷贝；sendfile的段从m_file_offset开始发
+            if (r.file_address){
+                m_batch->iv[m_iv_count].iov_base = r.file_address + part.offset;
+                m_batch->iv[m_iv_count].iov_len = part.len;
+                m_iv_count++;
+            } else {
+                m_file_offset = part.offset;
+            }
+            bytes_to_send += part.header_len + part.len;
+        }
+        if (r.trailer_len){
+            m_batch->iv[m_iv_count].iov_base = m_write_buf + r.trailer_start;
+            m_batch->iv[m_iv_count].iov_len = r.trailer_len;
+            m_iv_count++;
+            bytes_to_send += r.trailer_len;
+        }
+    }
+}
+
+//一批响应发送完毕：重置发送状态，把读缓冲区中还没处理的数据移到开头
+void http_conn::reset_after_send(){
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    m_write_idx = 0;
+    m_iv_count = 0;
+    m_iv_idx = 0;
+
+    int delta = m_request_start;
+    if (delta > 0){
+        memmove(m_read_buf, m_read_buf + delta, m_read_idx - delta);
+        m_read_idx -= delta;
+        m_checked_index -= delta;
+        m_start_line -= delta;
+        m_request_start = 0;
+        if (m_url) m_url -= delta;
+        if (m_version) m_version -= delta;
+        if (m_post) m_post->url = m_url;
+        m_body_start -= delta;
+        //已经解析过的头部记录的是偏移，也要跟着移动
+        for (int i = 0; i < m_header_count; ++i){
+            m_batch->headers[i].name -= delta;
+            m_batch->headers[i].value -= delta;
+        }
+    }
+
+    //写缓冲区的内容都已发出；读缓冲区中也没有剩余请求时连接进入空闲，两个缓冲区都还给内存池
+    if (m_read_idx == 0){
+        release_buffers();
+        return;
+    }
+    buffer_pool::release(m_write_buf, m_write_size);
+    m_write_buf = NULL;
+    m_write_size = 0;
+}
+
+//读缓冲区中还有流水线请求没有处理
+bool http_conn::need_process(){
+    return bytes_to_send == 0 && m_read_idx > 0;
+}
+
 bool http_conn::write(){
     int temp = 0;
     if ( bytes_to_send == 0 ) {
-        modfd( m_epollfd, m_sockfd, EPOLLIN ); 
-        init();
+        if (m_read_idx == 0){
+            modfd(m_epollfd, m_sockfd, m_handle, EPOLLIN, m_et); 
+        }
         return true;
     }
     while(1) {
-        temp = writev(m_sockfd, m_iv, m_iv_count); 
+        if (m_iv_idx < m_iv_count){
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = m_batch->iv + m_iv_idx;
+            msg.msg_iovlen = m_iv_count - m_iv_idx;
+            //后面还要用sendfile发文件时带上MSG_MORE，让内核把头部和文件开头凑成满的报文段
+            temp = sendmsg(m_sockfd, &msg, m_file_fd != -1 ? MSG_MORE : 0);
+        } else {
+            //iov都发完了，剩下的是最后一个响应的文件内容，直接从page cache发出
+            temp = sendfile(m_sockfd, m_file_fd, &m_file_offset, bytes_to_send);
+        }
         if ( temp <= -1 ) {
             if( errno == EAGAIN ) {
-                modfd( m_epollfd, m_sockfd, EPOLLOUT );
+                modfd(m_epollfd, m_sockfd, m_handle, EPOLLOUT, m_et);
                 return true;
             }
             unmap();
             return false;
         }
+        //stat之后文件被截短，sendfile读到文件末尾返回0，再循环下去永远发不完
+        if ( temp == 0 && bytes_to_send > 0 ) {
+            unmap();
+            return false;
+        }
 
         bytes_have_send += temp;
         bytes_to_send -= temp;
+        metrics::add(CNT_SENT_BYTES, temp);
 
-        if (bytes_have_send >= m_iv[0].iov_len) {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        } else {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - temp;
+        //跳过已经发完的iov，发了一部分的调整起点
+        while (m_iv_idx < m_iv_count && (size_t)temp >= m_batch->iv[m_iv_idx].iov_len){
+            temp -= m_batch->iv[m_iv_idx].iov_len;
+            m_iv_idx++;
+        }
+        if (m_iv_idx < m_iv_count && temp > 0){
+            m_batch->iv[m_iv_idx].iov_base = (char*)m_batch->iv[m_iv_idx].iov_base + temp;
+            m_batch->iv[m_iv_idx].iov_len -= temp;
         }
 
         if (bytes_to_send <= 0) {
+            metrics::record_since(STAGE_SEND, m_send_start);
             unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
-            if (m_linger) {  
-                init();
-                return true;
-            } else {    
+            if (!m_batch_linger) {
                 return false;
             }
+            reset_after_send();
+            //缓冲区里还有请求时由reactor交给线程池继续处理，否则等待新数据
+            if (m_read_idx == 0){
+                modfd(m_epollfd, m_sockfd, m_handle, EPOLLIN, m_et);
+            }
+            return true;
         }
 
     }    
@@ -338,52 +1052,128 @@ bool http_conn::write(){
 }
 
 bool http_conn::add_response( const char* format, ... ) {
-    if( m_write_idx >= WRITE_BUFFER_SIZE ) {
-        return false;
-    }
     va_list arg_list;
     va_start( arg_list, format );
-    int len = vsnprintf( m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list );
-    if( len >= ( WRITE_BUFFER_SIZE - 1 - m_write_idx ) ) {
+    bool ret = add_vresponse( format, arg_list );
+    va_end( arg_list );
+    return ret;
+}
+
+bool http_conn::add_vresponse( const char* format, va_list arg_list ) {
+    va_list copy;
+    va_copy( copy, arg_list );
+    int len = vsnprintf( NULL, 0, format, copy );
+    va_end( copy );
+    if( len < 0 || !reserve_write( len + 1 ) ) {
         return false;
     }
+    vsnprintf( m_write_buf + m_write_idx, m_write_size - m_write_idx, format, arg_list );
+    m_write_idx += len;
+    return true;
+}
+
+bool http_conn::add_bytes( const char* data, int len ) {
+    if( !reserve_write( len ) ) {
+        return false;
+    }
+    memcpy( m_write_buf + m_write_idx, data, len );
     m_write_idx += len;
-    va_end( arg_list );
     return true;
 }
 
 bool http_conn::add_status_line( int status, const char* title ) {
+    const header_span* line = status_line_span( status );
+    if( line ) {
+        return add_bytes( line->data, line->len );
+    }
     return add_response( "%s %d %s\r\n", "HTTP/1.1", status, title );
 }
 
 bool http_conn::add_headers(int content_len) {
-    add_content_length(content_len);
-    add_content_type();
-    add_linger();
-    add_blank_line();
+    return add_content_length(content_len) && add_content_type()
+        && add_linger() && add_blank_line();
 }
 
 bool http_conn::add_content_length(int content_len) {
-    return add_response( "Content-Length: %d\r\n", content_len );
+    char digits[20];
+    int len = fast_itoa( content_len, digits );
+    if( !reserve_write( CONTENT_LENGTH.len + len + CRLF.len ) ) {
+        return false;
+    }
+    add_bytes( CONTENT_LENGTH.data, CONTENT_LENGTH.len );
+    add_bytes( digits, len );
+    return add_bytes( CRLF.data, CRLF.len );
 }
 
 bool http_conn::add_linger(){
-    return add_response( "Connection: %s\r\n", ( m_linger == true ) ? "keep-alive" : "close" );
+    const header_span& conn = m_linger ? CONNECTION_KEEP_ALIVE : CONNECTION_CLOSE;
+    return add_bytes( conn.data, conn.len );
 }
 
 bool http_conn::add_blank_line() {
-    return add_response( "%s", "\r\n" );
+    return add_bytes( CRLF.data, CRLF.len );
+}
+
+bool http_conn::add_cache_control() {
+    if( m_max_age < 0 ) {
+        return true;
+    }
+    char digits[20];
+    int len = fast_itoa( m_max_age, digits );
+    return add_bytes( CACHE_CONTROL_MAX_AGE.data, CACHE_CONTROL_MAX_AGE.len )
+        && add_bytes( digits, len ) && add_bytes( CRLF.data, CRLF.len );
+}
+
+// Content-Range: bytes start-end/size
+bool http_conn::add_content_range( long start, long end ) {
+    char digits[64];
+    int len = fast_itoa( start, digits );
+    digits[ len++ ] = '-';
+    len += fast_itoa( end, digits + len );
+    digits[ len++ ] = '/';
+    len += fast_itoa( m_file_size, digits + len );
+    return add_bytes( CONTENT_RANGE.data, CONTENT_RANGE.len ) && add_bytes( digits, len )
+        && add_bytes( CRLF.data, CRLF.len );
+}
+
+//记录消息体的一段，段头部是m_write_buf中从header_start到当前末尾的内容
+void http_conn::add_part( int header_start, long offset, long len ) {
+    body_part& part = m_batch->parts[ m_part_count++ ];
+    part.header_start = header_start;
+    part.header_len = m_write_idx - header_start;
+    part.offset = offset;
+    part.len = len;
 }
 
 bool http_conn::add_content_type() {
-    return add_response("Content-Type:%s\r\n", "text/html");
+    return add_bytes( CONTENT_TYPE_HTML.data, CONTENT_TYPE_HTML.len );
+}
+
+//文件响应的Content-Type，内容压缩过时再加上Content-Encoding
+bool http_conn::add_file_type() {
+    if ( !add_bytes( CONTENT_TYPE.data, CONTENT_TYPE.len ) || !add_content( m_mime->type ) || !add_blank_line() ) {
+        return false;
+    }
+    if ( m_encoding == ENCODING_IDENTITY ) {
+        return true;
+    }
+    return add_bytes( CONTENT_ENCODING.data, CONTENT_ENCODING.len ) && add_content( encoding_name( m_encoding ) )
+        && add_blank_line();
+}
+
+bool http_conn::add_vary() {
+    return !m_vary || add_bytes( VARY_ACCEPT_ENCODING.data, VARY_ACCEPT_ENCODING.len );
 }
 
 bool http_conn::add_content( const char* content ) {  
-    return add_response( "%s", content );
+    return add_bytes( content, strlen( content ) );
 }
 
+//把响应追加到m_write_buf的末尾，并记录到本批的响应列表中
 bool http_conn::process_write(HTTP_CODE ret) {
+    int header_start = m_write_idx;
+    int part_start = m_part_count;
+    int trailer_start = 0, trailer_len = 0;
     switch (ret) {
         case INTERNAL_ERROR:
             add_status_line( 500, error_500_title );
@@ -414,37 +1204,208 @@ bool http_conn::process_write(HTTP_CODE ret) {
             }
             break;
         case FILE_REQUEST:
-            add_status_line(200, ok_200_title );
-            add_headers(m_file_stat.st_size);
-            m_iv[ 0 ].iov_base = m_write_buf;  
-            m_iv[ 0 ].iov_len = m_write_idx;
-            m_iv[ 1 ].iov_base = m_file_address;  
-            m_iv[ 1 ].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-
-            bytes_to_send = m_write_idx + m_file_stat.st_size;  
-            return true;
+            if (m_cache_entry) {
+                //缓存中已有生成好的状态行和实体头部
+                if ( !add_bytes( m_cache_entry->header, m_cache_entry->header_len ) ) {
+                    return false;
+                }
+            } else if ( !add_status_line( 200, ok_200_title ) || !add_content_length( m_file_size )
+                || !add_file_type() || !add_bytes( m_validators, m_validators_len ) ) {
+                return false;
+            }
+            //压缩过的内容不支持Range，不发Accept-Ranges
+            if ( ( m_encoding == ENCODING_IDENTITY && !add_bytes( ACCEPT_RANGES.data, ACCEPT_RANGES.len ) )
+                || !add_vary() || !add_cache_control() || !add_linger() || !add_blank_line() ) {
+                return false;
+            }
+            add_part( m_write_idx, 0, m_file_size );
+            break;
+        case PARTIAL_CONTENT:
+            if ( m_range_count == 1 ) {
+                long len = m_batch->range_end[0] - m_batch->range_start[0] + 1;
+                if ( !add_status_line( 206, "Partial Content" ) || !add_content_length( len ) || !add_file_type()
+                    || !add_content_range( m_batch->range_start[0], m_batch->range_end[0] ) ) {
+                    return false;
+                }
+            } else {
+                //多个区间用multipart/byteranges：先生成各段的分隔行和结束行，算出消息体总长度后再生成响应头。
+                //iov按响应中的顺序引用它们，在写缓冲区中的先后无关紧要
+                long body_len = 0;
+                for ( int i = 0; i < m_range_count; ++i ) {
+                    int start = m_write_idx;
+                    long len = m_batch->range_end[i] - m_batch->range_start[i] + 1;
+                    if ( !add_bytes( BYTERANGES_DELIMITER.data, BYTERANGES_DELIMITER.len ) || !add_file_type()
+                        || !add_content_range( m_batch->range_start[i], m_batch->range_end[i] ) || !add_blank_line() ) {
+                        return false;
+                    }
+                    add_part( start, m_batch->range_start[i], len );
+                    body_len += m_write_idx - start + len;
+                }
+                trailer_start = m_write_idx;
+                if ( !add_bytes( BYTERANGES_CLOSE.data, BYTERANGES_CLOSE.len ) ) {
+                    return false;
+                }
+                trailer_len = BYTERANGES_CLOSE.len;
+                body_len += trailer_len;
+                header_start = m_write_idx;
+                if ( !add_status_line( 206, "Partial Content" ) || !add_content_length( body_len )
+                    || !add_bytes( CONTENT_TYPE_BYTERANGES.data, CONTENT_TYPE_BYTERANGES.len ) ) {
+                    return false;
+                }
+            }
+            if ( !add_bytes( m_validators, m_validators_len ) || !add_vary() || !add_cache_control()
+                || !add_linger() || !add_blank_line() ) {
+                return false;
+            }
+            if ( m_range_count == 1 ) {
+                add_part( m_write_idx, m_batch->range_start[0], m_batch->range_end[0] - m_batch->range_start[0] + 1 );
+            }
+            break;
+        case RANGE_NOT_SATISFIABLE: {
+            //Content-Range: bytes */size
+            char digits[24];
+            int len = 0;
+            digits[ len++ ] = '*';
+            digits[ len++ ] = '/';
+            len += fast_itoa( m_file_size, digits + len );
+            if ( !add_status_line( 416, "Range Not Satisfiable" ) || !add_bytes( CONTENT_RANGE.data, CONTENT_RANGE.len )
+                || !add_bytes( digits, len ) || !add_bytes( CRLF.data, CRLF.len ) || !add_headers( 0 ) ) {
+                return false;
+            }
+            break;
+        }
+        case POST_REQUEST: {
+            int status = m_post->status;
+            if ( !add_status_line( status, status_title( status ) ) || !add_headers( m_post->reply.size() )
+                || !add_bytes( m_post->reply.data(), m_post->reply.size() ) ) {
+                return false;
+            }
+            break;
+        }
+        case ROUTE_REQUEST:
+            //先让处理函数把内容写进写缓冲区，再在后面生成响应头，iov按头部、内容的顺序发送
+            trailer_start = m_write_idx;
+            if ( call_route( trailer_len ) ) {
+                header_start = trailer_start + trailer_len;
+                break;
+            }
+            //处理失败，丢弃已写入的内容
+            m_write_idx = trailer_start;
+            trailer_start = trailer_len = 0;
+            add_status_line( 500, error_500_title );
+            add_headers( strlen( error_500_form ) );
+            if ( ! add_content( error_500_form ) ) {
+                return false;
+            }
+            break;
+        case METHOD_NOT_ALLOWED: {
+            const char* allow = m_route->get && m_route->post ? "GET, POST" : ( m_route->get ? "GET" : "POST" );
+            if ( !add_status_line( 405, status_title( 405 ) ) || !add_response( "Allow: %s\r\n", allow )
+                || !add_headers( 0 ) ) {
+                return false;
+            }
+            break;
+        }
+        case NOT_MODIFIED:
+            //304没有消息体，只带上校验头部和缓存策略
+            if ( !add_status_line( 304, "Not Modified" ) || !add_bytes( m_validators, m_validators_len )
+                || !add_vary() || !add_cache_control() || !add_linger() || !add_blank_line() ) {
+                return false;
+            }
+            break;
         default:
             return false;
     }
- 
-    m_iv[ 0 ].iov_base = m_write_buf;
-    m_iv[ 0 ].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+
+    //文件资源的所有权转移给这个响应，发送完成后由unmap释放
+    response& r = m_batch->responses[ m_response_count++ ];
+    bool has_body = ( ret == FILE_REQUEST || ret == PARTIAL_CONTENT );
+    r.header_start = header_start;
+    r.header_len = m_write_idx - header_start;
+    r.file_address = has_body ? m_file_address : NULL;
+    r.file_size = has_body ? m_file_size : 0;
+    r.cache = m_cache_entry;
+    r.part_start = part_start;
+    r.part_count = m_part_count - part_start;
+    r.trailer_start = trailer_start;
+    r.trailer_len = trailer_len;
+    m_file_address = 0;
+    m_cache_entry = NULL;
     return true;
 }
 
-//处理http请求的入口函数
+//调用路由的处理函数，内容写在写缓冲区的末尾，之后接着生成响应头。content_len返回内容的长度
+bool http_conn::call_route( int& content_len ) {
+    int content_start = m_write_idx;
+    route_request req;
+    req.conn = this;
+    req.path.data = m_url;
+    req.path.len = strcspn( m_url, "?" );
+    req.query.data = m_url + req.path.len + ( m_url[ req.path.len ] == '?' );
+    req.query.len = strlen( req.query.data );
+    req.rest.data = m_url + m_route_matched;
+    req.rest.len = req.path.len - m_route_matched;
+    route_response resp( this );
+    if ( !m_route->get( req, resp ) ) {
+        return false;
+    }
+    content_len = m_write_idx - content_start;
+    return add_status_line( resp.status(), status_title( resp.status() ) ) && add_content_length( content_len )
+        && add_bytes( CONTENT_TYPE.data, CONTENT_TYPE.len ) && add_content( resp.content_type() ) && add_blank_line()
+        && add_bytes( resp.headers(), resp.headers_len() ) && add_linger() && add_blank_line();
+}
+
+//处理http请求的入口函数。读缓冲区中可能有多个流水线请求，
+//依次解析并把响应追加到同一个写缓冲区，最后一起发送
 void http_conn::process(){
-    HTTP_CODE read_ret = process_read();
-    if (read_ret == NO_REQUEST){
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        return ; 
+    if (!acquire_batch()){
+        worker_close();
+        return;
+    }
+    while (true) {
+        long parse_start = metrics::now();
+        m_lookup_start = 0;
+        HTTP_CODE read_ret = process_read();
+        if (read_ret == NO_REQUEST){
+            break;
+        }
+        //请求不完整的几次解析不计入，只记录得到完整请求的这一次
+        long parse_end = metrics::now();
+        if (m_lookup_start){
+            metrics::record(STAGE_PARSE, m_lookup_start - parse_start);
+            metrics::record(STAGE_LOOKUP, parse_end - m_lookup_start);
+        } else {
+            metrics::record(STAGE_PARSE, parse_end - parse_start);
+        }
+        if (read_ret == BAD_REQUEST){
+            m_linger = false;  //请求格式错误时无法确定下一个请求从哪里开始
+        }
+        if (!process_write(read_ret)){
+            worker_close();
+            return;
+        }
+        //访问日志和按状态码的计数，状态码直接取自刚生成的状态行
+        const char* status = m_write_buf + m_batch->responses[m_response_count - 1].header_start + 9;
+        const unsigned char* ip = (const unsigned char*)&m_address.sin_addr;
+        LOG_INFO("access ip=%u.%u.%u.%u method=%s url=%s status=%.3s", ip[0], ip[1], ip[2], ip[3],
+                 method_names[m_method], m_url ? m_url : "-", status);
+        metrics::add(CNT_REQUESTS);
+        if (status[0] >= '1' && status[0] <= '5'){
+            metrics::add((METRIC_COUNTER)(CNT_STATUS_1XX + status[0] - '1'));
+        }
+        m_batch_linger = m_linger;
+        next_request();
+        //不保活、批次已满、用了sendfile或者是multipart响应（二者只能放在最后）时这一批到此为止
+        if (!m_batch_linger || m_response_count == MAX_PIPELINE || m_file_fd != -1
+            || m_batch->responses[ m_response_count - 1 ].part_count > 1){
+            break;
+        }
     }
-    bool write_ret = process_write(read_ret);
-    if (!write_ret){
-        close_conn();
+    if (m_response_count == 0){
+        hand_back(EPOLLIN);
+        return ; 
     }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT) ; 
-}
\ No newline at end of file
+    prepare_send();
+    m_send_start = metrics::now();
+    hand_back(EPOLLOUT);
+}
@@ -18,16 +18,35 @@
 #include "locker.h"
 #include <sys/uio.h>
 #include <string.h>
+#include <atomic>
 #include "lst_timer.h"
+#include "file_cache.h"
+#include "http_header.h"
+#include "buffer_pool.h"
+#include "http_scan.h"
+#include "http_body.h"
+#include "route.h"
+#include "log.h"
+#include "metrics.h"
+#include "conn_table.h"
 
 class http_conn{
 
 public:
-    static int m_epollfd; 
-    static int m_user_count;  
-    static const int READ_BUFFER_SIZE = 2048;  
-    static const int WRITE_BUFFER_SIZE = 2048;  
+    static std::atomic<int> m_user_count;   //reactor线程和工作线程都会增减
+    static bool m_et;         //连接socket是否使用边沿触发
+    static long m_sendfile_threshold;  //不小于该大小的文件用sendfile发送，负数表示不启用
+    static file_cache* m_file_cache;   //静态文件缓存，NULL表示不启用
+    static int m_max_age;              //静态文件响应的Cache-Control: max-age（秒），负数表示不发送
+    static bool m_compress;            //是否按Accept-Encoding发送压缩的内容
+    static file_cache* m_encoded_cache;    //压缩结果的缓存，NULL表示只使用预压缩文件
+    static route_table* m_routes;      //动态接口的路由，NULL表示只提供静态文件
     static const int FILENAME_LEN = 200;
+    static const int MAX_PIPELINE = 16;     //一批最多合并发送的流水线响应数
+    static const int MAX_HEADERS = 32;      //一个请求最多的头部数，超过按错误请求处理
+    static const int MAX_RANGES = 16;       //Range最多的区间数，超过时忽略Range发送整个文件
+    static const int MIN_COMPRESS_SIZE = 128;   //小于该大小的文件压缩后省不了几个字节，不压缩
+    static const int BODY_WINDOW = 8192;    //流式接收请求体时读缓冲区中请求体部分的上限
 
     enum METHOD {GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT};
     /*
@@ -48,20 +67,54 @@ public:
         FILE_REQUEST        :   文件请求,获取文件成功
         INTERNAL_ERROR      :   表示服务器内部错误
         CLOSED_CONNECTION   :   表示客户端已经关闭连接了
+        NOT_MODIFIED        :   条件请求的资源没有变化，回复304
+        PARTIAL_CONTENT     :   Range请求，回复206，区间在m_range_start/m_range_end中
+        RANGE_NOT_SATISFIABLE : Range中没有可满足的区间，回复416
+        POST_REQUEST        :   POST请求处理完毕，回复处理函数在m_post中给出的响应
+        ROUTE_REQUEST       :   匹配到动态接口，生成响应时调用m_route的处理函数
+        METHOD_NOT_ALLOWED  :   匹配到的路由没有注册该方法，回复405
     */
-    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION };
+    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION, NOT_MODIFIED, PARTIAL_CONTENT, RANGE_NOT_SATISFIABLE, POST_REQUEST, ROUTE_REQUEST, METHOD_NOT_ALLOWED };
     
     // 从状态机的三种可能状态，即行的读取状态，分别表示
     // 1.读取到一个完整的行 2.行出错 3.行数据尚且不完整
     enum LINE_STATUS { LINE_OK = 0, LINE_BAD, LINE_OPEN };
 
+    /*
+        连接所处的阶段，reactor据此选择超时时间
+        PHASE_IDLE      :   还没有收到新请求的任何数据（新连接或保活连接空闲中）
+        PHASE_HEADER    :   正在接收请求行和头部
+        PHASE_BODY      :   头部已完整，正在接收请求体
+    */
+    enum CONN_PHASE { PHASE_IDLE = 0, PHASE_HEADER, PHASE_BODY };
+
+    /*
+        连接当前归谁所有，只有所有者可以读写连接的状态
+        OWNER_NONE      :   没有连接
+        OWNER_REACTOR   :   所属reactor线程：读写socket、调整定时器、关闭连接
+        OWNER_WORKER    :   已交给线程池（在队列中或正在process），reactor不能碰它
+        OWNER_REARM     :   工作线程处理完，正在重新注册事件，随后交还reactor
+        OWNER_CLOSING   :   归工作线程期间超时了，定时器已删除，工作线程处理完后自己关闭
+        交接：reactor在append之前置为WORKER；工作线程用CAS依次改为REARM、REACTOR，
+        失败说明已经是CLOSING；超时的reactor用CAS从WORKER或REARM改为CLOSING，失败说明已经交还。
+        重新注册在交还之前，这样reactor关闭连接时工作线程不会再用这个fd（可能已被复用）调用epoll_ctl
+    */
+    enum CONN_OWNER { OWNER_NONE = 0, OWNER_REACTOR, OWNER_WORKER, OWNER_REARM, OWNER_CLOSING };
+
     http_conn(){}
     ~http_conn(){}
     void process(); 
-    void init(int sockfd, const sockaddr_in & addr);  
+    void init(int sockfd, const sockaddr_in & addr, int epollfd, uint64_t handle);  
     void close_conn();  
+    //reactor线程把连接交给线程池之前调用，append失败时用to_reactor收回
+    void to_worker() { m_owner.store(OWNER_WORKER, std::memory_order_relaxed); }
+    void to_reactor() { m_owner.store(OWNER_REACTOR, std::memory_order_relaxed); }
+    bool owned_by_reactor();
+    //超时，在reactor线程调用。返回true表示连接归reactor，可以立即关闭；否则由工作线程处理完后关闭
+    bool expire();
     bool read();
     bool write();
+    bool need_process();
     HTTP_CODE process_read();
     bool process_write(HTTP_CODE ret);
 
@@ -76,22 +129,41 @@ public:
     //用于填充应答
     void unmap();
     bool add_response( const char* format, ... );
+    bool add_vresponse( const char* format, va_list arg_list );
+    bool add_bytes( const char* data, int len );
     bool add_content( const char* content );
     bool add_content_type();
+    bool add_file_type();
+    bool add_vary();
     bool add_status_line( int status, const char* title );
     bool add_headers( int content_length );
     bool add_content_length( int content_length );
     bool add_linger();
     bool add_blank_line();
+    bool add_cache_control();
+    bool add_content_range( long start, long end );
 
     int getfd();
+    uint64_t handle() { return m_handle; }
+    CONN_PHASE phase();
+
+    // 当前请求的头部，视图指向m_read_buf，只在本次请求处理期间有效。
+    // 同名头部出现多次时返回第一个
+    bool get_header( HEADER_ID id, str_view& value );
+    bool get_header( const char* name, str_view& value );   //任意名称，线性查找
 
     util_timer* timer;    //定时器
+    int worker;           //上次处理该连接的工作线程，工作窃取线程池据此保持亲和性
+    long queued_at;       //放进线程池队列的时间
     
 private:
+    int m_epollfd;    //连接所属reactor的epoll
+    uint64_t m_handle;            //在conn_table中的句柄，注册epoll时作为data
+    std::atomic<int> m_owner;     //CONN_OWNER。不在构造函数中初始化，槽位没用到时不触碰它的内存，init时才设置
     int m_sockfd; 
     sockaddr_in m_address; 
-    char m_read_buf[READ_BUFFER_SIZE];
+    char* m_read_buf;       //从buffer_pool借来的读缓冲区，空闲时为NULL
+    int m_read_size;
     int m_read_idx;  
 
     int m_checked_index;  
@@ -101,20 +173,115 @@ private:
     char * m_url;  
     char * m_version;  
     METHOD m_method; 
-    char * m_host; 
-    int m_content_length;  
+    long m_content_length;  
+    bool m_chunked;                 // Transfer-Encoding: chunked
+
+    // 头部表：名称和值都只记录在m_read_buf中的偏移和长度（缓冲区扩大或搬移后仍然有效），
+    // 常见头部通过m_header_index按HEADER_ID直接定位
+    struct header_field {
+        HEADER_ID id;
+        int name;
+        int name_len;
+        int value;
+        int value_len;
+    };
+    int m_header_count;
+    signed char m_header_index[ HDR_COUNT ];    //m_headers的下标，-1表示没有该头部
     bool m_linger; 
 
     CHECK_STATE m_check_state; 
 
     void init();  //初始化连接
+    void hand_back(int ev);
+    void worker_close();
+    void next_request();
+    void prepare_send();
+    void reset_after_send();
+    bool grow_read_buf();
+    bool header_received();
+    bool reserve_write(int len);
+    void release_buffers();
+    bool acquire_batch();
+    bool not_modified();
+    HTTP_CODE parse_ranges();
+    HTTP_CODE begin_post();
+    bool call_route( int& content_len );
+    HTTP_CODE read_post_body();
+    void abort_post();
+    bool find_encoded( int accept );
+    HTTP_CODE use_cache_entry();
+    void add_part( int header_start, long offset, long len );
 
-    char m_write_buf[ WRITE_BUFFER_SIZE ];  
+    char* m_write_buf;                      //从buffer_pool借来的写缓冲区，空闲时为NULL
+    int m_write_size;
     int m_write_idx;                        
     char* m_file_address;                   
+    int m_file_fd;                          // sendfile模式下打开的文件，否则为-1
+    cache_entry* m_cache_entry;             // 命中缓存时占用的条目，m_file_address指向其内容
     struct stat m_file_stat;                
-    struct iovec m_iv[2];                   
+    long m_file_size;                       // 发送的内容的长度，压缩过的内容小于原文件
+    const mime_type* m_mime;                // 按扩展名得到的Content-Type
+    int m_encoding;                         // 发送的内容的Content-Encoding
+    bool m_vary;                            // 响应随Accept-Encoding变化，需要带上Vary
+    const char* m_validators;               // 当前文件的"ETag: ...\r\nLast-Modified: ...\r\n"
+    int m_validators_len;
+    int m_etag_len;                         // ETag的值从m_validators + ETAG.len开始
+    char m_validator_buf[ VALIDATORS_LEN ]; // 未命中缓存时在这里生成校验头部
+    int m_range_count;                      // Range请求的区间数（在m_batch中），0表示发送整个文件
+
+    // 正在流式接收的POST请求体：已交给处理函数的部分从读缓冲区中移除，
+    // 请求行和头部留在m_body_start之前
+    const route* m_route;                   // 当前请求匹配到的路由
+    int m_route_matched;                    // 路径中匹配的长度
+    post_handler* m_post_handler;           // 请求还没有结束时非NULL
+    post_context* m_post;                   // 第一次收到POST时分配
+    chunked_decoder m_chunked_decoder;
+    long m_body_left;                       // Content-Length请求体还没有收到的字节数
+    int m_body_start;
+
+    // 一个待发送的响应：m_write_buf中的头部（错误页面还包括内容）、来自文件的若干段消息体
+    // 和multipart的结束分隔行。file_address/cache是整个文件的映射或缓存条目，发送完后释放；
+    // 有文件段而file_address为NULL表示用sendfile发送，只能是一批中的最后一个
+    struct response {
+        int header_start;
+        int header_len;
+        char* file_address;
+        long file_size;
+        cache_entry* cache;
+        int part_start;                     // 消息体各段在m_parts中的位置
+        int part_count;
+        int trailer_start;                  // 文件段之后来自写缓冲区的内容：multipart/byteranges的结束分隔行或动态接口的响应内容
+        int trailer_len;
+    };
+    // 消息体的一段：可选的段头部（multipart中每个区间前的分隔行和Content-Range）加上文件的一个区间
+    struct body_part {
+        int header_start;
+        int header_len;
+        long offset;
+        long len;
+    };
+    // 解析和发送一批请求时才用到的数组，合起来有几KB。连接有数据要处理时从buffer_pool借一块，
+    // 和读写缓冲区一起在连接空闲或关闭时归还，空闲的保活连接不占这部分内存
+    struct batch_state {
+        header_field headers[ MAX_HEADERS ];
+        long range_start[ MAX_RANGES ];     // Range请求的各个闭区间
+        long range_end[ MAX_RANGES ];
+        response responses[ MAX_PIPELINE ]; // 流水线中已生成、待一起发送的响应
+        body_part parts[ MAX_PIPELINE + MAX_RANGES ];  // multipart响应总是一批中的最后一个
+        struct iovec iv[ 2 * MAX_PIPELINE + 2 * MAX_RANGES ];
+    };
+    batch_state* m_batch;                   // 空闲时为NULL
+    int m_batch_size;                       // buffer_pool分配的实际大小
+    int m_response_count;
+    int m_part_count;
+    bool m_batch_linger;                    // 本批最后一个响应后是否保持连接
+    int m_request_start;                    // 当前请求在m_read_buf中的起始位置
+    long m_lookup_start;                    // 本次process_read中进入do_request的时间，0表示没有
+    long m_send_start;                      // 本批响应生成好的时间
+
     int m_iv_count;
+    int m_iv_idx;                           // 下一个要发送的iov
+    off_t m_file_offset;                    // sendfile的文件偏移
 
     int bytes_to_send;              // 将要发送的数据的字节数
     int bytes_have_send;            // 已经发送的字节数
@@ -0,0 +1,293 @@
+#ifndef HTTP_HEADER_H
+#define HTTP_HEADER_H
+
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/*
+预先格式化好的响应头片段。状态行和固定的头部在编译期就是完整的字节串，
+拼响应时直接memcpy，Content-Length用整数转十进制代替vsnprintf。
+*/
+struct header_span {
+    const char* data;
+    int len;
+};
+
+#define HEADER_SPAN( s ) { s, sizeof( s ) - 1 }
+
+static const header_span STATUS_200 = HEADER_SPAN( "HTTP/1.1 200 OK\r\n" );
+static const header_span STATUS_206 = HEADER_SPAN( "HTTP/1.1 206 Partial Content\r\n" );
+static const header_span STATUS_304 = HEADER_SPAN( "HTTP/1.1 304 Not Modified\r\n" );
+static const header_span STATUS_400 = HEADER_SPAN( "HTTP/1.1 400 Bad Request\r\n" );
+static const header_span STATUS_403 = HEADER_SPAN( "HTTP/1.1 403 Forbidden\r\n" );
+static const header_span STATUS_404 = HEADER_SPAN( "HTTP/1.1 404 Not Found\r\n" );
+static const header_span STATUS_416 = HEADER_SPAN( "HTTP/1.1 416 Range Not Satisfiable\r\n" );
+static const header_span STATUS_500 = HEADER_SPAN( "HTTP/1.1 500 Internal Error\r\n" );
+
+static const header_span CONTENT_LENGTH = HEADER_SPAN( "Content-Length: " );
+static const header_span CONTENT_TYPE_HTML = HEADER_SPAN( "Content-Type:text/html\r\n" );
+static const header_span CONNECTION_KEEP_ALIVE = HEADER_SPAN( "Connection: keep-alive\r\n" );
+static const header_span CONNECTION_CLOSE = HEADER_SPAN( "Connection: close\r\n" );
+static const header_span ACCEPT_RANGES = HEADER_SPAN( "Accept-Ranges: bytes\r\n" );
+static const header_span CONTENT_RANGE = HEADER_SPAN( "Content-Range: bytes " );
+static const header_span CONTENT_TYPE_BYTERANGES = HEADER_SPAN( "Content-Type: multipart/byteranges; boundary=3d6b6a416f9b5\r\n" );
+static const header_span BYTERANGES_DELIMITER = HEADER_SPAN( "\r\n--3d6b6a416f9b5\r\n" );
+static const header_span BYTERANGES_CLOSE = HEADER_SPAN( "\r\n--3d6b6a416f9b5--\r\n" );
+static const header_span CONTENT_TYPE = HEADER_SPAN( "Content-Type:" );
+static const header_span CONTENT_ENCODING = HEADER_SPAN( "Content-Encoding: " );
+static const header_span VARY_ACCEPT_ENCODING = HEADER_SPAN( "Vary: Accept-Encoding\r\n" );
+static const header_span CACHE_CONTROL_MAX_AGE = HEADER_SPAN( "Cache-Control: max-age=" );
+static const header_span ETAG = HEADER_SPAN( "ETag: " );
+static const header_span LAST_MODIFIED = HEADER_SPAN( "Last-Modified: " );
+static const header_span CRLF = HEADER_SPAN( "\r\n" );
+
+// 返回预先生成的状态行，未知状态码返回NULL
+inline const header_span* status_line_span( int status ) {
+    switch( status ) {
+        case 200: return &STATUS_200;
+        case 206: return &STATUS_206;
+        case 304: return &STATUS_304;
+        case 400: return &STATUS_400;
+        case 403: return &STATUS_403;
+        case 404: return &STATUS_404;
+        case 416: return &STATUS_416;
+        case 500: return &STATUS_500;
+        default: return NULL;
+    }
+}
+
+// 非负整数转十进制，buf至少20字节，返回写入的长度（不加'\0'）
+inline int fast_itoa( unsigned long value, char* buf ) {
+    char tmp[20];
+    int len = 0;
+    do {
+        tmp[len++] = '0' + value % 10;
+        value /= 10;
+    } while( value );
+    for( int i = 0; i < len; ++i ) {
+        buf[i] = tmp[len - 1 - i];
+    }
+    return len;
+}
+
+struct mime_type {
+    const char* ext;
+    const char* type;
+    bool compressible;      //文本类的内容压缩效果好，图片等已经压缩过的格式不再压缩
+};
+
+// 按文件扩展名返回MIME类型，未知的扩展名按二进制数据处理
+inline const mime_type* find_mime_type( const char* path ) {
+    static const mime_type types[] = {
+        { "html", "text/html", true },
+        { "htm", "text/html", true },
+        { "css", "text/css", true },
+        { "js", "application/javascript", true },
+        { "json", "application/json", true },
+        { "txt", "text/plain", true },
+        { "xml", "application/xml", true },
+        { "svg", "image/svg+xml", true },
+        { "jpg", "image/jpeg", false },
+        { "jpeg", "image/jpeg", false },
+        { "png", "image/png", false },
+        { "gif", "image/gif", false },
+        { "ico", "image/x-icon", false },
+        { "webp", "image/webp", false },
+        { "pdf", "application/pdf", false },
+        { "mp4", "video/mp4", false },
+        { NULL, "application/octet-stream", false },
+    };
+    const char* dot = strrchr( path, '.' );
+    const char* slash = strrchr( path, '/' );
+    int i = 0;
+    if( dot && ( !slash || dot > slash ) ) {
+        for( ; types[i].ext; ++i ) {
+            if( strcasecmp( types[i].ext, dot + 1 ) == 0 ) {
+                break;
+            }
+        }
+    } else {
+        while( types[i].ext ) {
+            ++i;
+        }
+    }
+    return &types[i];
+}
+
+// 非负整数转十六进制（小写），buf至少16字节，返回写入的长度
+inline int fast_htoa( unsigned long value, char* buf ) {
+    static const char digits[] = "0123456789abcdef";
+    char tmp[16];
+    int len = 0;
+    do {
+        tmp[len++] = digits[value & 15];
+        value >>= 4;
+    } while( value );
+    for( int i = 0; i < len; ++i ) {
+        buf[i] = tmp[len - 1 - i];
+    }
+    return len;
+}
+
+// time_t转成HTTP日期，如"Sun, 06 Nov 1994 08:49:37 GMT"，buf至少30字节，返回长度
+inline int format_http_date( time_t t, char* buf ) {
+    struct tm tm;
+    gmtime_r( &t, &tm );
+    return strftime( buf, 30, "%a, %d %b %Y %H:%M:%S GMT", &tm );
+}
+
+// 解析HTTP日期（IMF-fixdate格式），失败返回-1
+inline time_t parse_http_date( const char* s ) {
+    struct tm tm;
+    memset( &tm, 0, sizeof( tm ) );
+    if( !strptime( s, "%a, %d %b %Y %H:%M:%S GMT", &tm ) ) {
+        return -1;
+    }
+    return timegm( &tm );
+}
+
+static const int VALIDATORS_LEN = 112;
+
+/*
+生成静态文件的校验头部"ETag: "<mtime>-<size>"\r\nLast-Modified: <date>\r\n"，返回长度。
+ETag由修改时间和大小的十六进制组成（带引号），从buf + ETAG.len开始，长度写入etag_len。
+压缩后的内容用suffix（编码名）区分ETag。buf至少VALIDATORS_LEN字节
+*/
+inline int format_validators( const struct stat& st, char* buf, int& etag_len, const char* suffix = NULL ) {
+    int len = 0;
+    memcpy( buf, ETAG.data, ETAG.len );
+    len += ETAG.len;
+    buf[len++] = '"';
+    len += fast_htoa( st.st_mtime, buf + len );
+    buf[len++] = '-';
+    len += fast_htoa( st.st_size, buf + len );
+    if( suffix ) {
+        int suffix_len = strlen( suffix );
+        buf[len++] = '-';
+        memcpy( buf + len, suffix, suffix_len );
+        len += suffix_len;
+    }
+    buf[len++] = '"';
+    etag_len = len - ETAG.len;
+    memcpy( buf + len, CRLF.data, CRLF.len );
+    len += CRLF.len;
+    memcpy( buf + len, LAST_MODIFIED.data, LAST_MODIFIED.len );
+    len += LAST_MODIFIED.len;
+    len += format_http_date( st.st_mtime, buf + len );
+    memcpy( buf + len, CRLF.data, CRLF.len );
+    return len + CRLF.len;
+}
+
+// If-None-Match的值（逗号分隔的ETag列表或"*"）中是否有与etag弱比较相等的
+inline bool etag_match( const char* list, int list_len, const char* etag, int etag_len ) {
+    const char* end = list + list_len;
+    while( list < end ) {
+        while( list < end && ( *list == ' ' || *list == '\t' || *list == ',' ) ) {
+            ++list;
+        }
+        const char* token = list;
+        while( list < end && *list != ',' ) {
+            ++list;
+        }
+        int len = list - token;
+        while( len > 0 && ( token[len - 1] == ' ' || token[len - 1] == '\t' ) ) {
+            --len;
+        }
+        if( len == 1 && token[0] == '*' ) {
+            return true;
+        }
+        if( len > 2 && token[0] == 'W' && token[1] == '/' ) {
+            token += 2;
+            len -= 2;
+        }
+        if( len == etag_len && memcmp( token, etag, len ) == 0 ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 解析一个不超过18位的十进制数，p移到数字之后，没有数字或太长返回-1
+inline long parse_range_number( const char*& p, const char* end ) {
+    long value = 0;
+    int digits = 0;
+    while( p < end && *p >= '0' && *p <= '9' ) {
+        if( ++digits > 18 ) {
+            return -1;
+        }
+        value = value * 10 + ( *p++ - '0' );
+    }
+    return digits ? value : -1;
+}
+
+/*
+解析Range头部的值，如"bytes=0-99, 200-, -50"，每个区间转成闭区间[starts[i], ends[i]]并截断到文件大小。
+返回可满足的区间个数，都不可满足返回0；格式错误或超过max个区间返回-1，调用者应忽略Range发送整个文件
+*/
+inline int parse_byte_ranges( const char* s, int len, long size, long* starts, long* ends, int max ) {
+    const char* end = s + len;
+    if( len < 6 || strncasecmp( s, "bytes=", 6 ) != 0 ) {
+        return -1;
+    }
+    const char* p = s + 6;
+    int count = 0;
+    bool any = false;
+    while( p < end ) {
+        while( p < end && ( *p == ' ' || *p == '\t' ) ) {
+            ++p;
+        }
+        long first = -1, last = -1;
+        if( p < end && *p == '-' ) {
+            //后缀区间：最后last个字节
+            ++p;
+            last = parse_range_number( p, end );
+            if( last < 0 ) {
+                return -1;
+            }
+        } else {
+            first = parse_range_number( p, end );
+            if( first < 0 || p >= end || *p++ != '-' ) {
+                return -1;
+            }
+            if( p < end && *p >= '0' && *p <= '9' ) {
+                last = parse_range_number( p, end );
+                if( last < first ) {
+                    return -1;
+                }
+            }
+        }
+        while( p < end && ( *p == ' ' || *p == '\t' ) ) {
+            ++p;
+        }
+        if( p < end && *p++ != ',' ) {
+            return -1;
+        }
+        any = true;
+
+        long start, stop;
+        if( first < 0 ) {
+            if( last == 0 || size == 0 ) {
+                continue;
+            }
+            start = last > size ? 0 : size - last;
+            stop = size - 1;
+        } else {
+            if( first >= size ) {
+                continue;
+            }
+            start = first;
+            stop = ( last < 0 || last >= size ) ? size - 1 : last;
+        }
+        if( count == max ) {
+            return -1;
+        }
+        starts[count] = start;
+        ends[count] = stop;
+        ++count;
+    }
+    return any ? count : -1;
+}
+
+#endif
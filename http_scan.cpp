@@ -0,0 +1,158 @@
+#include "http_scan.h"
+#include <string.h>
+#include <strings.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SCAN_X86
+#endif
+
+int find_line_end_scalar(const char* buf, int start, int end){
+    for (int i = start; i < end; ++i){
+        if (buf[i] == '\r' || buf[i] == '\n'){
+            return i;
+        }
+    }
+    return end;
+}
+
+#ifdef HTTP_SCAN_X86
+//和"\r\n"逐字节比较，movemask得到匹配位置的位图，最低位的1就是第一个结束符
+__attribute__((target("sse2")))
+int find_line_end_sse2(const char* buf, int start, int end){
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    int i = start;
+    for (; i + 16 <= end; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)(buf + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+        if (mask){
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return find_line_end_scalar(buf, i, end);
+}
+
+__attribute__((target("avx2")))
+int find_line_end_avx2(const char* buf, int start, int end){
+    //请求行和头部大多不到32字节，先看16字节，找不到再按32字节扫描长的行
+    int i = start;
+    if (i + 16 <= end){
+        const __m128i cr = _mm_set1_epi8('\r');
+        const __m128i lf = _mm_set1_epi8('\n');
+        __m128i v = _mm_loadu_si128((const __m128i*)(buf + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+        if (mask){
+            return i + __builtin_ctz(mask);
+        }
+        i += 16;
+    }
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    for (; i + 32 <= end; i += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i*)(buf + i));
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+        if (mask){
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return find_line_end_sse2(buf, i, end);
+}
+#else
+int find_line_end_sse2(const char* buf, int start, int end){
+    return find_line_end_scalar(buf, start, end);
+}
+
+int find_line_end_avx2(const char* buf, int start, int end){
+    return find_line_end_scalar(buf, start, end);
+}
+#endif
+
+static const char* s_impl_name = "scalar";
+
+static line_end_func select_line_end(){
+#ifdef HTTP_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")){
+        s_impl_name = "avx2";
+        return find_line_end_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")){
+        s_impl_name = "sse2";
+        return find_line_end_sse2;
+    }
+#endif
+    return find_line_end_scalar;
+}
+
+line_end_func find_line_end = select_line_end();
+
+const char* line_end_impl(){
+    return s_impl_name;
+}
+
+/*
+头部名称的哈希：首字符、末字符（转小写）和长度的组合。
+系数是挑过的，下面这些名称落在32个槽中互不冲突，查找只需比较一次；
+以后加入的名称即使冲突也会线性探测到下一个空槽，不影响正确性。
+*/
+static const int HEADER_SLOTS = 32;
+
+struct header_name {
+    const char* name;
+    int len;
+    HEADER_ID id;
+};
+
+static const header_name known_headers[] = {
+    { "Host", 4, HDR_HOST },
+    { "Connection", 10, HDR_CONNECTION },
+    { "Content-Length", 14, HDR_CONTENT_LENGTH },
+    { "Content-Type", 12, HDR_CONTENT_TYPE },
+    { "Transfer-Encoding", 17, HDR_TRANSFER_ENCODING },
+    { "Accept", 6, HDR_ACCEPT },
+    { "Accept-Encoding", 15, HDR_ACCEPT_ENCODING },
+    { "Accept-Language", 15, HDR_ACCEPT_LANGUAGE },
+    { "User-Agent", 10, HDR_USER_AGENT },
+    { "Cookie", 6, HDR_COOKIE },
+    { "If-None-Match", 13, HDR_IF_NONE_MATCH },
+    { "If-Modified-Since", 17, HDR_IF_MODIFIED_SINCE },
+    { "Range", 5, HDR_RANGE },
+    { "If-Range", 8, HDR_IF_RANGE },
+    { "Expect", 6, HDR_EXPECT },
+    { "Cache-Control", 13, HDR_CACHE_CONTROL },
+    { "Referer", 7, HDR_REFERER },
+    { "Upgrade", 7, HDR_UPGRADE },
+};
+
+static inline unsigned header_hash(const char* name, int len){
+    return ((name[0] | 0x20) * 7 + (name[len - 1] | 0x20) * 24 + len) & (HEADER_SLOTS - 1);
+}
+
+struct header_slots {
+    const header_name* slot[HEADER_SLOTS];
+    header_slots(){
+        memset(slot, 0, sizeof(slot));
+        for (unsigned i = 0; i < sizeof(known_headers) / sizeof(known_headers[0]); ++i){
+            unsigned h = header_hash(known_headers[i].name, known_headers[i].len);
+            while (slot[h]){
+                h = (h + 1) & (HEADER_SLOTS - 1);
+            }
+            slot[h] = &known_headers[i];
+        }
+    }
+};
+
+static const header_slots s_header_slots;
+
+HEADER_ID header_lookup(const char* name, int len){
+    if (len <= 0){
+        return HDR_UNKNOWN;
+    }
+    for (unsigned h = header_hash(name, len); s_header_slots.slot[h]; h = (h + 1) & (HEADER_SLOTS - 1)){
+        const header_name* entry = s_header_slots.slot[h];
+        if (entry->len == len && strncasecmp(entry->name, name, len) == 0){
+            return entry->id;
+        }
+    }
+    return HDR_UNKNOWN;
+}
@@ -0,0 +1,54 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+/*
+HTTP请求解析的热点函数：
+1. 查找行结束符'\r'/'\n'，一次比较16/32字节。启动时按CPU支持的指令集（AVX2/SSE2）
+   选择实现，其他平台用逐字节的版本。
+2. 头部名称分类，用首尾字符和长度算一个哈希直接定位，代替一串strncasecmp。
+*/
+
+// 能识别的请求头部，HDR_UNKNOWN表示其他头部
+enum HEADER_ID {
+    HDR_UNKNOWN = 0,
+    HDR_HOST,
+    HDR_CONNECTION,
+    HDR_CONTENT_LENGTH,
+    HDR_CONTENT_TYPE,
+    HDR_TRANSFER_ENCODING,
+    HDR_ACCEPT,
+    HDR_ACCEPT_ENCODING,
+    HDR_ACCEPT_LANGUAGE,
+    HDR_USER_AGENT,
+    HDR_COOKIE,
+    HDR_IF_NONE_MATCH,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_RANGE,
+    HDR_IF_RANGE,
+    HDR_EXPECT,
+    HDR_CACHE_CONTROL,
+    HDR_REFERER,
+    HDR_UPGRADE,
+    HDR_COUNT
+};
+
+// 指向请求缓冲区内部的字符串片段，不拷贝、不以'\0'结尾
+struct str_view {
+    const char* data;
+    int len;
+};
+
+// 返回buf[start, end)中第一个'\r'或'\n'的下标，没有则返回end
+typedef int (*line_end_func)(const char* buf, int start, int end);
+extern line_end_func find_line_end;
+
+// 各个实现，基准测试用。当前CPU不支持的实现不能调用
+int find_line_end_scalar(const char* buf, int start, int end);
+int find_line_end_sse2(const char* buf, int start, int end);
+int find_line_end_avx2(const char* buf, int start, int end);
+const char* line_end_impl();   // 启动时选中的实现的名字
+
+// 头部名称（不区分大小写）对应的HEADER_ID
+HEADER_ID header_lookup(const char* name, int len);
+
+#endif
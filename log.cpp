@@ -0,0 +1,182 @@
+#include "log.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <atomic>
+
+static const int TEXT_SIZE = logger::RECORD_SIZE - 16;
+
+struct log_record {
+    long time_ns;       //CLOCK_REALTIME
+    int level;
+    int len;
+    char text[TEXT_SIZE];
+};
+
+// 一个线程的环形缓冲区，只有该线程写入tail、后台线程写入head
+struct log_ring {
+    std::atomic<unsigned> head;
+    char pad[60];       //head和tail在不同的缓存行
+    std::atomic<unsigned> tail;
+    char tid[16];       //"[线程id] "
+    int tid_len;
+    log_ring* next;
+    log_record records[logger::RING_RECORDS];
+};
+
+std::atomic<int> logger::m_level(LOG_LEVEL_ERROR + 1);
+
+static __thread log_ring* local_ring;
+//所有线程的缓冲区，只在头部插入、运行期间不删除，后台线程遍历时不需要加锁
+static std::atomic<log_ring*> rings(NULL);
+static std::atomic<long> dropped_count(0);
+//start/stop在主线程中设置，后台线程和打日志的线程读取。release/acquire保证看到running为true时log_fd已经设置好
+static std::atomic<bool> running(false);
+static int log_fd = -1;
+static pthread_t flusher;
+//缓冲区过半时生产者通过它唤醒后台线程，不用等到下一个10ms
+static std::atomic<int> wakeup(0);
+
+static long futex(int op, int val, const struct timespec* timeout){
+    return syscall(SYS_futex, (int*)&wakeup, op, val, timeout, NULL, 0);
+}
+
+//补齐到同样宽度
+static const char* level_names[] = { "DEBUG ", "INFO  ", "WARN  ", "ERROR " };
+
+void logger::write(int level, const char* format, ...){
+    log_ring* ring = local_ring;
+    if (!ring){
+        if (!running.load(std::memory_order_acquire)){
+            return;
+        }
+        ring = new log_ring;
+        ring->head.store(0, std::memory_order_relaxed);
+        ring->tail.store(0, std::memory_order_relaxed);
+        ring->tid_len = snprintf(ring->tid, sizeof(ring->tid), "[%ld] ", (long)syscall(SYS_gettid));
+        ring->next = rings.load(std::memory_order_relaxed);
+        while (!rings.compare_exchange_weak(ring->next, ring, std::memory_order_release)){
+        }
+        local_ring = ring;
+    }
+    unsigned tail = ring->tail.load(std::memory_order_relaxed);
+    unsigned used = tail - ring->head.load(std::memory_order_acquire);
+    if (used == (unsigned)RING_RECORDS){
+        dropped_count.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    log_record& rec = ring->records[tail & (RING_RECORDS - 1)];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec.time_ns = ts.tv_sec * 1000000000L + ts.tv_nsec;
+    rec.level = level;
+    va_list arg_list;
+    va_start(arg_list, format);
+    int len = vsnprintf(rec.text, TEXT_SIZE, format, arg_list);
+    va_end(arg_list);
+    rec.len = len < 0 ? 0 : (len < TEXT_SIZE ? len : TEXT_SIZE - 1);
+    ring->tail.store(tail + 1, std::memory_order_release);
+    //每填满半个缓冲区才有一次系统调用
+    if (used == (unsigned)RING_RECORDS / 2){
+        wakeup.fetch_add(1, std::memory_order_release);
+        futex(FUTEX_WAKE_PRIVATE, 1, NULL);
+    }
+}
+
+long logger::dropped(){
+    return dropped_count.load(std::memory_order_relaxed);
+}
+
+//把所有缓冲区中的记录格式化成文本行批量写出，返回写出的记录数
+static int drain(){
+    static char buf[65536];
+    static time_t last_sec = -1;
+    static char date[32];
+    static int date_len;
+    int len = 0, count = 0;
+    for (log_ring* ring = rings.load(std::memory_order_acquire); ring; ring = ring->next){
+        unsigned head = ring->head.load(std::memory_order_relaxed);
+        unsigned tail = ring->tail.load(std::memory_order_acquire);
+        for (; head != tail; ++head){
+            const log_record& rec = ring->records[head & (logger::RING_RECORDS - 1)];
+            if (len + TEXT_SIZE + 64 > (int)sizeof(buf)){
+                ::write(log_fd, buf, len);
+                len = 0;
+            }
+            //日期每秒只格式化一次
+            time_t sec = rec.time_ns / 1000000000L;
+            if (sec != last_sec){
+                struct tm tm;
+                localtime_r(&sec, &tm);
+                date_len = strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S.", &tm);
+                last_sec = sec;
+            }
+            //行首"日期.微秒 级别 [线程id] "，逐段拷贝，不用snprintf
+            memcpy(buf + len, date, date_len);
+            len += date_len;
+            long usec = (rec.time_ns % 1000000000L) / 1000;
+            for (int i = 5; i >= 0; --i, usec /= 10){
+                buf[len + i] = '0' + usec % 10;
+            }
+            len += 6;
+            buf[len++] = ' ';
+            memcpy(buf + len, level_names[rec.level], 6);
+            len += 6;
+            memcpy(buf + len, ring->tid, ring->tid_len);
+            len += ring->tid_len;
+            memcpy(buf + len, rec.text, rec.len);
+            len += rec.len;
+            buf[len++] = '\n';
+            ++count;
+        }
+        ring->head.store(head, std::memory_order_release);
+    }
+    if (len > 0){
+        ::write(log_fd, buf, len);
+    }
+    return count;
+}
+
+//没有记录时最多睡眠10ms，日志最多延迟这么久写出
+static void* flush_loop(void*){
+    struct timespec timeout = { 0, 10000000 };
+    while (running.load(std::memory_order_acquire)){
+        int seq = wakeup.load(std::memory_order_acquire);
+        if (drain() == 0){
+            futex(FUTEX_WAIT_PRIVATE, seq, &timeout);
+        }
+    }
+    return NULL;
+}
+
+bool logger::start(int fd, int level){
+    if (running.load(std::memory_order_acquire)){
+        return false;
+    }
+    log_fd = fd;
+    running.store(true, std::memory_order_release);
+    if (pthread_create(&flusher, NULL, flush_loop, NULL) != 0){
+        running.store(false, std::memory_order_release);
+        return false;
+    }
+    m_level.store(level, std::memory_order_relaxed);
+    return true;
+}
+
+//缓冲区不释放，已经分离的线程可能还持有它们
+void logger::stop(){
+    if (!running.load(std::memory_order_acquire)){
+        return;
+    }
+    m_level.store(LOG_LEVEL_ERROR + 1, std::memory_order_relaxed);
+    running.store(false, std::memory_order_release);
+    wakeup.fetch_add(1, std::memory_order_release);
+    futex(FUTEX_WAKE_PRIVATE, 1, NULL);
+    pthread_join(flusher, NULL);
+    drain();
+}
@@ -0,0 +1,52 @@
+#ifndef LOG_H
+#define LOG_H
+
+/*
+异步日志。每个线程有自己的单生产者单消费者环形缓冲区，打日志时只在本线程的缓冲区中
+格式化一条记录，不加锁也不调用write；后台线程每10ms或有缓冲区过半时把所有缓冲区中的记录批量写出。
+缓冲区满时丢弃新记录并计数，不阻塞调用者。
+
+级别低于LOG_MIN_LEVEL的日志在编译期就被去掉（如-DLOG_MIN_LEVEL=LOG_LEVEL_WARN），
+其余的再按运行时的级别过滤。logger没有启动时所有日志都直接丢弃。
+*/
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+
+#include <atomic>
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+class logger {
+public:
+    static const int RECORD_SIZE = 256;     //一条记录的大小，过长的内容被截断
+    static const int RING_RECORDS = 1024;   //每个线程缓冲区的记录数（2的幂）
+
+    // 启动后台线程，日志写到fd，低于level的日志不记录
+    static bool start(int fd, int level);
+    // 写出剩余的记录并停止后台线程
+    static void stop();
+    static void write(int level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+    // 因缓冲区满而丢弃的记录数
+    static long dropped();
+
+    static std::atomic<int> m_level;    //运行时级别，没有启动时大于所有级别。只用作过滤，不需要和其他数据同步
+};
+
+#define LOG_AT(level, format, ...) \
+    do { \
+        if (level >= LOG_MIN_LEVEL && level >= logger::m_level.load(std::memory_order_relaxed)) { \
+            logger::write(level, format, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_DEBUG(format, ...) LOG_AT(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...)  LOG_AT(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...)  LOG_AT(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_AT(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+
+#endif
@@ -4,25 +4,47 @@
 #include <stdio.h>
 #include <time.h>
 #include <arpa/inet.h>
+#include <stdint.h>
 
 #define BUFFER_SIZE 64
 class util_timer;  
 class http_conn;
 
+// 定时器使用的时钟：单调时钟，毫秒。COARSE版本不陷入内核，精度为一个jiffy，足够做超时判断
+inline time_t timer_now_ms() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC_COARSE, &ts );
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 // 定时器类
 class util_timer {
 public:
-    util_timer() : prev(NULL), next(NULL){}
+    util_timer() : prev(NULL), next(NULL), slot(-1){}
 
 public:
-   time_t expire;   
-   void (*cb_func)( http_conn* ); 
-   http_conn* user_data; 
+   time_t expire;   // 到期时间，timer_now_ms()时基
+   void (*cb_func)( uint64_t ); 
+   uint64_t user_data;  // 连接的句柄（conn_table），回调中连接已经不在时查不到
    util_timer* prev;
    util_timer* next; 
+   int slot;        // 时间轮中所在的槽，升序链表不使用
 };
 
-class sort_timer_lst {
+// 定时器容器接口，reactor启动时选择升序链表或时间轮
+class timer_container {
+public:
+    virtual ~timer_container() {}
+    virtual void add_timer( util_timer* timer ) = 0;
+    // 定时器的超时时间改变（延长或提前）后调用
+    virtual void adjust_timer( util_timer* timer ) = 0;
+    // 从容器中删除并释放定时器
+    virtual void del_timer( util_timer* timer ) = 0;
+    // 执行所有到期定时器的回调并释放它们
+    virtual void tick() = 0;
+};
+
+class sort_timer_lst : public timer_container {
 public:
     sort_timer_lst() : head( NULL ), tail( NULL ) {}
     ~sort_timer_lst() {
@@ -52,12 +74,24 @@ public:
         add_timer(timer, head);
     }
     
-    /* 当某个定时任务发生变化时，调整对应的定时器在链表中的位置。这个函数只考虑被调整的定时器的
-    超时时间延长的情况，即该定时器需要往链表的尾部移动。*/
+    /* 当某个定时任务发生变化时，调整对应的定时器在链表中的位置。超时时间延长时往链表的尾部移动；
+    提前时（如头部、请求体的期限比空闲超时短）从链表中摘下，再从头部开始重新插入。*/
     void adjust_timer(util_timer* timer) {
         if( !timer )  {
             return;
         }
+        if( timer->prev && timer->expire < timer->prev->expire ) {
+            timer->prev->next = timer->next;
+            if( timer->next ) {
+                timer->next->prev = timer->prev;
+            } else {
+                tail = timer->prev;
+            }
+            timer->prev = NULL;
+            timer->next = NULL;
+            add_timer( timer );
+            return;
+        }
         util_timer* tmp = timer->next;
     
         if( !tmp || ( timer->expire < tmp->expire ) ) {
@@ -112,8 +146,7 @@ public:
         if( !head ) {
             return;
         }
-        printf( "timer tick\n" );
-        time_t cur = time( NULL );  // 获取当前系统时间
+        time_t cur = timer_now_ms();  // 获取当前时间
         util_timer* tmp = head;
 
         while( tmp ) {
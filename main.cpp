@@ -12,23 +12,20 @@
 #include "threadpool.h"
 #include <signal.h>
 #include "http_conn.h"
+#include "reactor.h"
 #include <assert.h>
+#include <vector>
 
-#define MAX_FD 65535  // 最大文件描述符个数。
-#define MAX_EVENTS_NUM 10000   //最大监听数量
-
-#define FD_LIMIT 65535
 #define MAX_EVENT_NUMBER 1024
-#define TIMESLOT 5
 
 static int pipefd[2];
-static sort_timer_lst timer_lst;
-static int epollfd = 0;
 
 /*
 模拟的是preactor模式，主线程负责所有的IO操作，工作线程只负责逻辑业务。
 当监听到读事件的时候，读出来，然后将读到的内容封装成一个任务类。
 交给线程池，插入线程队列。然后线程池调用运行。
+指定 -r N 时开启多reactor模式：主线程只负责accept，连接的IO由N个子reactor线程完成。
+再指定 -s 时每个子reactor各自持有一个SO_REUSEPORT监听socket并自己accept，主线程只处理信号。
 */
 
 //添加信号捕捉
@@ -40,6 +37,24 @@ void addsig(int sig, void (handler)(int)){
     sigaction(sig, &sa, NULL); 
 }
 
+//运行指标中读取时才计算的值
+static long current_connections() {
+    return http_conn::m_user_count;
+}
+
+static long log_dropped() {
+    return logger::dropped();
+}
+
+static long connection_slots() {
+    return conn_table::capacity();
+}
+
+static threadpool<http_conn>* gauge_pool = NULL;
+static long queued_tasks() {
+    return gauge_pool ? gauge_pool->pending() : 0;
+}
+
 void sig_handler( int sig ) {
     int save_errno = errno;
     int msg = sig;
@@ -47,75 +62,227 @@ void sig_handler( int sig ) {
     errno = save_errno;
 }
 
-void cb_func( http_conn* user_data ) {
-    epoll_ctl( epollfd, EPOLL_CTL_DEL, user_data->getfd(), 0 );
-    assert( user_data );
-    close( user_data->getfd() );
-    printf( "close fd %d\n", user_data->getfd() );
-}
-
-void timer_handler() {
-    timer_lst.tick();
-    alarm(TIMESLOT);
-}
-
 //添加文件描述符进epoll
 //从epoll中删除文件描述符
 //修改文件描述符
-extern void addfd(int epollfd, int fd, bool one_shot);
+extern void addfd(int epollfd, int fd, bool one_shot, bool et);
 extern void removefd(int epollfd, int fd);
-extern void modfd(int epollfd, int fd, int ev);
+extern void modfd(int epollfd, int fd, uint64_t handle, int ev, bool et);
 extern int setnonblocking(int fd);
 
 
 int main(int argc, char* argv[]){
 
-    if (argc <= 1) {
-        printf("按照如下格式运行：%s port_number\n", basename(argv[0])); 
+    //-r 子reactor数量，0表示单reactor模式（主线程处理所有IO）
+    //-s 每个子reactor使用独立的SO_REUSEPORT监听socket
+    //-b listen的backlog
+    //-e 连接socket使用边沿触发
+    //-w 使用时间轮管理定时器（默认升序链表）
+    //-i/-H/-B 空闲、接收头部、接收请求体的超时时间（毫秒）
+    //-f 不小于该字节数的文件用sendfile零拷贝发送
+    //-c 静态文件缓存的容量（字节）
+    //-z 按Accept-Encoding发送压缩内容，参数为压缩结果缓存的容量（字节），0表示只用预压缩文件
+    //-t 工作线程数量
+    //-L 日志级别，0-3依次为DEBUG、INFO、WARN、ERROR
+    //-C/-Q 连接数、线程池排队任务数的高水位，超过时暂停accept，排队超过时新请求直接回复503
+    //-P 单个客户端IP的最大连接数
+    //-R 503响应中Retry-After的秒数
+    //-l 线程池使用无锁任务队列
+    //-W 线程池使用每线程队列+工作窃取
+    int sub_reactor_num = 0;
+    bool reuseport = false;
+    int backlog = 5;
+    bool use_time_wheel = false;
+    long cache_capacity = 0;
+    long encoded_capacity = 0;
+    int thread_num = 8;
+    int log_level = LOG_LEVEL_INFO;
+    QUEUE_MODE queue_mode = QUEUE_LOCKED;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:sb:ewi:H:B:f:c:z:a:t:lWL:C:Q:P:R:")) != -1) {
+        switch (opt) {
+            case 'r': {
+                sub_reactor_num = atoi(optarg);
+                break;
+            }
+            case 's': {
+                reuseport = true;
+                break;
+            }
+            case 'b': {
+                backlog = atoi(optarg);
+                break;
+            }
+            case 'e': {
+                http_conn::m_et = true;
+                break;
+            }
+            case 'w': {
+                use_time_wheel = true;
+                break;
+            }
+            case 'i': {
+                reactor::m_idle_timeout = atoi(optarg);
+                break;
+            }
+            case 'H': {
+                reactor::m_header_timeout = atoi(optarg);
+                break;
+            }
+            case 'B': {
+                reactor::m_body_timeout = atoi(optarg);
+                break;
+            }
+            case 'f': {
+                http_conn::m_sendfile_threshold = atol(optarg);
+                break;
+            }
+            case 'c': {
+                cache_capacity = atol(optarg);
+                break;
+            }
+            case 'z': {
+                http_conn::m_compress = true;
+                encoded_capacity = atol(optarg);
+                break;
+            }
+            case 'a': {
+                http_conn::m_max_age = atoi(optarg);
+                break;
+            }
+            case 't': {
+                thread_num = atoi(optarg);
+                break;
+            }
+            case 'l': {
+                queue_mode = QUEUE_LOCK_FREE;
+                break;
+            }
+            case 'W': {
+                queue_mode = QUEUE_WORK_STEALING;
+                break;
+            }
+            case 'L': {
+                log_level = atoi(optarg);
+                break;
+            }
+            case 'C': {
+                admission::m_max_conns = atoi(optarg);
+                break;
+            }
+            case 'Q': {
+                admission::m_max_queue = atoi(optarg);
+                break;
+            }
+            case 'P': {
+                admission::m_max_per_ip = atoi(optarg);
+                break;
+            }
+            case 'R': {
+                admission::m_retry_after = atoi(optarg);
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+    }
+
+    if (optind >= argc || sub_reactor_num < 0 || backlog <= 0 || (reuseport && sub_reactor_num == 0)
+        || reactor::m_idle_timeout <= 0 || reactor::m_header_timeout <= 0 || reactor::m_body_timeout <= 0
+        || admission::m_max_conns < 0 || admission::m_max_queue < 0 || admission::m_max_per_ip < 0 || admission::m_retry_after < 0) {
+        printf("按照如下格式运行：%s [-r sub_reactor_num [-s]] [-b backlog] [-e] [-w] [-i idle_ms] [-H header_ms] [-B body_ms] [-f sendfile_bytes] [-c cache_bytes] [-z compress_cache_bytes] [-a max_age] [-t thread_num] [-l | -W] [-L log_level] [-C max_conns] [-Q max_queue] [-P max_per_ip] [-R retry_after] port_number\n", basename(argv[0])); 
         exit(-1);
     }
 
-    int port = atoi(argv[1]); 
+    int port = atoi(argv[optind]); 
     addsig(SIGPIPE, SIG_IGN);  //对于终止信号，进行忽略。 防止客户端终止终止服务端 https://blog.csdn.net/weixin_36750623/article/details/91370604
 
+    logger::start(STDOUT_FILENO, log_level);
+    metrics::add_gauge("webserver_connections", current_connections);
+    metrics::add_gauge("webserver_log_dropped_total", log_dropped);
+    metrics::add_gauge("webserver_connection_slots", connection_slots);
+    metrics::add_gauge("webserver_queued_tasks", queued_tasks);
+
     threadpool<http_conn> * pool = NULL;
     try{
-        pool = new threadpool<http_conn>;
+        pool = new threadpool<http_conn>(thread_num, 10000, queue_mode);
     } catch(...){
         exit(-1);
     }
+    gauge_pool = pool;
 
-    http_conn * users = new http_conn[ MAX_FD];
-    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    int reuse = 1;
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (cache_capacity > 0) {
+        try{
+            http_conn::m_file_cache = new file_cache(cache_capacity);
+        } catch(...){
+            exit(-1);
+        }
+    }
+    if (encoded_capacity > 0) {
+        try{
+            http_conn::m_encoded_cache = new file_cache(encoded_capacity);
+        } catch(...){
+            exit(-1);
+        }
+    }
+
+    //动态接口，在任何连接建立之前注册并编译
+    static upload_stat_handler upload_stat;
+    http_conn::m_routes = new route_table;
+    http_conn::m_routes->add_get("/health", health_route);
+    http_conn::m_routes->add_get("/metrics", metrics_route);
+    http_conn::m_routes->add_post("/upload", &upload_stat);
+    http_conn::m_routes->compile();
 
-    //绑定
-    struct sockaddr_in address;
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(port);
-    bind(listenfd, (struct sockaddr*)&address, sizeof(address));
-    listen(listenfd, 5);
+    //主reactor：单reactor模式下处理所有连接，多reactor模式下只负责监听和信号
+    reactor main_reactor(pool, use_time_wheel);
+    std::vector<reactor*> sub_reactors;
+    for (int i = 0; i < sub_reactor_num; ++i) {
+        sub_reactors.push_back(new reactor(pool, use_time_wheel));
+        if (reuseport && !sub_reactors.back()->listen_on(port, backlog)) {
+            printf("listen on port %d failed\n", port);
+            exit(-1);
+        }
+        sub_reactors.back()->start();
+    }
+    int next_reactor = 0;
 
     epoll_event events[MAX_EVENTS_NUM];
-    int epollfd = epoll_create(5);
-    addfd(epollfd, listenfd, false);  
-    http_conn::m_epollfd = epollfd;
+    int epollfd = main_reactor.get_epollfd();
+    int listenfd = -1;
+    if (!reuseport) {
+        listenfd = open_listenfd(port, backlog, false);
+        if (listenfd == -1) {
+            printf("listen on port %d failed\n", port);
+            exit(-1);
+        }
+        addfd(epollfd, listenfd, false, false);  
+    }
 
     //upadate:创建管道
     int piperet = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
     assert( piperet != -1 );
     setnonblocking( pipefd[1] );
-    addfd( epollfd, pipefd[0], true); 
+    addfd( epollfd, pipefd[0], false, false); 
+
+    //文件缓存的inotify事件由主线程处理
+    int inotifyfd = -1;
+    if (http_conn::m_file_cache) {
+        inotifyfd = http_conn::m_file_cache->get_inotify_fd();
+        addfd(epollfd, inotifyfd, false, false);
+    }
+    int encoded_inotifyfd = -1;
+    if (http_conn::m_encoded_cache) {
+        encoded_inotifyfd = http_conn::m_encoded_cache->get_inotify_fd();
+        addfd(epollfd, encoded_inotifyfd, false, false);
+    }
 
-    //设置信号处理函数
-    addsig(SIGALRM, sig_handler);
+    //设置信号处理函数，定时器由各reactor的timerfd驱动
     addsig(SIGTERM, sig_handler);
+    addsig(SIGUSR1, sig_handler);
     bool stop_server = false;
-
-    bool timeout = false;
-    alarm(TIMESLOT);  
+    bool accept_paused = false;
 
     while ( !stop_server ) {
         //主线程循环检测有没有事件发生
@@ -126,26 +293,39 @@ int main(int argc, char* argv[]){
 
         //循环遍历事件数组
         for (int i = 0; i < num; i++){
-            int sockfd = events[i].data.fd;
-            if (sockfd == listenfd){
-                struct sockaddr_in client_address;
-                socklen_t client_addrlen = sizeof(client_address);
-                int connfd = accept(listenfd, (struct sockaddr*)&client_address, &client_addrlen);
-                if (http_conn::m_user_count >= MAX_FD){
-                    close(connfd);
-                    continue;
+            uint64_t data = events[i].data.u64;
+            int sockfd = conn_table::is_handle(data) ? -1 : (int)data;
+            if (sockfd != -1 && sockfd == listenfd){
+                //一次取空全连接队列；过载时暂停，剩下的留在全连接队列里
+                while (true) {
+                    if (admission::overloaded(pool->pending())) {
+                        admission::pause_accept(epollfd, listenfd);
+                        accept_paused = true;
+                        break;
+                    }
+                    struct sockaddr_in client_address;
+                    socklen_t client_addrlen = sizeof(client_address);
+                    int connfd = accept4(listenfd, (struct sockaddr*)&client_address, &client_addrlen, SOCK_NONBLOCK);
+                    if (connfd < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        break;
+                    }
+                    long accepted = metrics::now();
+                    if (sub_reactors.empty()) {
+                        main_reactor.add_conn(connfd, client_address, accepted);
+                    } else {
+                        //轮询分发给子reactor
+                        reactor* sub = sub_reactors[next_reactor];
+                        next_reactor = (next_reactor + 1) % sub_reactors.size();
+                        if (!sub->dispatch(connfd, client_address, accepted)) {
+                            metrics::add(CNT_REJECTED);
+                            close(connfd);
+                        }
+                    }
                 }
 
-                users[connfd].init(connfd, client_address);
-                //创建个定时器，设置回调函数和超时事件，绑定到用户上，并加入链接中。
-                util_timer* timer = new util_timer;
-                timer->user_data = &users[connfd];
-                timer->cb_func = cb_func;
-                time_t cur = time( NULL );
-                timer->expire = cur + 3 * TIMESLOT;
-                users[connfd].timer = timer;
-                timer_lst.add_timer( timer );
-
             } else if ( ( sockfd == pipefd[0] ) && ( events[i].events & EPOLLIN ) ) {
                 //处理信号
                 int sig;
@@ -156,59 +336,48 @@ int main(int argc, char* argv[]){
                 } else {
                     for (int i = 0; i < recvret; ++i){
                         switch ( signals[i] ){
-                            case SIGALRM: {
-                                //延迟处理，因为IO优先级更高
-                                timeout = true;
-                                break;
-                            }
                             case SIGTERM: {
                                 stop_server = true;
+                                break;
+                            }
+                            case SIGUSR1: {
+                                //运行指标写到标准错误，和日志分开
+                                char buf[8192];
+                                int len = metrics::format(buf, sizeof(buf));
+                                ::write(STDERR_FILENO, buf, len);
+                                break;
                             }
                         }
                     }
                 }
-            } else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
-                util_timer* timer = users[sockfd].timer; 
-                if (timer){
-                    timer_lst.del_timer(timer);
-                }
-                users[sockfd].close_conn();
-            } else if (events[i].events & EPOLLIN){ 
-                
-                if (users[sockfd].read()){
-                    util_timer* timer = users[sockfd].timer;
-                    if( timer ) {
-                        time_t cur = time( NULL );
-                        timer->expire = cur + 3 * TIMESLOT;
-                        printf( "adjust timer once\n" );
-                        timer_lst.adjust_timer( timer );
-                    }
-                    pool->append(users + sockfd);  //将http_conn指针传入工作线程，线程池。
-                } else {
-                    util_timer* timer = users[sockfd].timer; 
-                    if (timer){
-                        timer_lst.del_timer(timer);
-                    }
-                    users[sockfd].close_conn();
-                }
-            } else if (events[i].events & EPOLLOUT){
-                if (!users[sockfd].write()) {  
-                    users[sockfd].close_conn();
-                }
+            } else if (sockfd != -1 && sockfd == inotifyfd) {
+                http_conn::m_file_cache->handle_inotify();
+            } else if (sockfd != -1 && sockfd == encoded_inotifyfd) {
+                http_conn::m_encoded_cache->handle_inotify();
+            } else {
+                main_reactor.handle_event(data, events[i].events);
             }
         }
-        //处理定时事件
-        if( timeout ) {
-            timer_handler();
-            timeout = false;
+        //主reactor的timerfd每TIMER_TICK_MS唤醒一次，暂停accept后最多这么久检查一次能否恢复
+        if (accept_paused && admission::recovered(pool->pending())) {
+            admission::resume_accept(epollfd, listenfd);
+            accept_paused = false;
         }
     }
 
-    close(epollfd);
-    close(listenfd);
+    for (size_t i = 0; i < sub_reactors.size(); ++i) {
+        sub_reactors[i]->stop();
+        delete sub_reactors[i];
+    }
+    if (listenfd != -1) {
+        close(listenfd);
+    }
     close(pipefd[1]);
     close(pipefd[0]);
-    delete [] users;
     delete pool;
+    delete http_conn::m_file_cache;
+    delete http_conn::m_encoded_cache;
+    delete http_conn::m_routes;
+    logger::stop();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,171 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <atomic>
+
+// 一个线程的指标，只有该线程写入。用relaxed的load+store代替fetch_add，读取的线程看到的是某个时刻的值
+struct thread_metrics {
+    std::atomic<long> counters[ CNT_COUNT ];
+    std::atomic<long> buckets[ STAGE_COUNT ][ metrics::BUCKETS ];
+    std::atomic<long> sum[ STAGE_COUNT ];
+    std::atomic<long> max[ STAGE_COUNT ];
+    thread_metrics* next;
+};
+
+static __thread thread_metrics* local_metrics;
+//所有线程的指标，只在头部插入、不删除，汇总时不需要加锁
+static std::atomic<thread_metrics*> all_metrics( NULL );
+
+static const char* stage_names[] = { "accept", "queue", "parse", "lookup", "send" };
+
+struct gauge {
+    const char* name;
+    long ( *func )();
+};
+static gauge gauges[ metrics::MAX_GAUGES ];
+static int gauge_count = 0;
+
+bool metrics::add_gauge( const char* name, long ( *func )() ) {
+    if ( gauge_count == MAX_GAUGES ) {
+        return false;
+    }
+    gauges[ gauge_count ].name = name;
+    gauges[ gauge_count ].func = func;
+    gauge_count++;
+    return true;
+}
+
+static thread_metrics* get_local() {
+    thread_metrics* m = local_metrics;
+    if ( !m ) {
+        m = new thread_metrics;
+        memset( (void*)m, 0, sizeof( *m ) );
+        m->next = all_metrics.load( std::memory_order_relaxed );
+        while ( !all_metrics.compare_exchange_weak( m->next, m, std::memory_order_release ) ) {
+        }
+        local_metrics = m;
+    }
+    return m;
+}
+
+static inline void bump( std::atomic<long>& v, long n ) {
+    v.store( v.load( std::memory_order_relaxed ) + n, std::memory_order_relaxed );
+}
+
+void metrics::add( METRIC_COUNTER counter, long n ) {
+    bump( get_local()->counters[ counter ], n );
+}
+
+void metrics::record( METRIC_STAGE stage, long ns ) {
+    if ( ns < 0 ) {
+        ns = 0;
+    }
+    thread_metrics* m = get_local();
+    bump( m->buckets[ stage ][ bucket_of( ns ) ], 1 );
+    bump( m->sum[ stage ], ns );
+    if ( ns > m->max[ stage ].load( std::memory_order_relaxed ) ) {
+        m->max[ stage ].store( ns, std::memory_order_relaxed );
+    }
+}
+
+//小于SUB_BUCKETS的值每个值一个桶；之后最高位决定在第几组，其下SUB_BITS位决定组内的桶
+int metrics::bucket_of( long ns ) {
+    if ( ns < SUB_BUCKETS ) {
+        return ns;
+    }
+    if ( ns >= ( 1L << MAX_BITS ) ) {
+        return BUCKETS - 1;
+    }
+    int shift = 63 - __builtin_clzl( ns ) - SUB_BITS;
+    return ( shift + 1 ) * SUB_BUCKETS + ( ( ns >> shift ) & ( SUB_BUCKETS - 1 ) );
+}
+
+long metrics::bucket_upper( int bucket ) {
+    if ( bucket < SUB_BUCKETS ) {
+        return bucket;
+    }
+    int shift = bucket / SUB_BUCKETS - 1;
+    long lower = (long)( SUB_BUCKETS + bucket % SUB_BUCKETS ) << shift;
+    return lower + ( 1L << shift ) - 1;
+}
+
+// 往buf追加格式化的内容，空间不够时截断
+static void append( char* buf, int size, int& len, const char* format, ... ) __attribute__((format(printf, 4, 5)));
+static void append( char* buf, int size, int& len, const char* format, ... ) {
+    if ( len >= size - 1 ) {
+        return;
+    }
+    va_list arg_list;
+    va_start( arg_list, format );
+    int n = vsnprintf( buf + len, size - len, format, arg_list );
+    va_end( arg_list );
+    if ( n > 0 ) {
+        len = n < size - len ? len + n : size - 1;
+    }
+}
+
+int metrics::format( char* buf, int size ) {
+    static const char* counter_names[] = {
+        "webserver_connections_accepted_total", "webserver_connections_rejected_total",
+        "webserver_queue_rejected_total", "webserver_ip_rejected_total", "webserver_accept_pauses_total",
+        "webserver_requests_total" };
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+    long counters[ CNT_COUNT ] = { 0 };
+    long buckets[ BUCKETS ];
+    int len = 0;
+    for ( thread_metrics* m = all_metrics.load( std::memory_order_acquire ); m; m = m->next ) {
+        for ( int i = 0; i < CNT_COUNT; ++i ) {
+            counters[ i ] += m->counters[ i ].load( std::memory_order_relaxed );
+        }
+    }
+    for ( int i = 0; i < gauge_count; ++i ) {
+        append( buf, size, len, "%s %ld\n", gauges[ i ].name, gauges[ i ].func() );
+    }
+    for ( int i = 0; i < CNT_STATUS_1XX; ++i ) {
+        append( buf, size, len, "%s %ld\n", counter_names[ i ], counters[ i ] );
+    }
+    for ( int i = CNT_STATUS_1XX; i <= CNT_STATUS_5XX; ++i ) {
+        append( buf, size, len, "webserver_responses_total{code=\"%dxx\"} %ld\n", i - CNT_STATUS_1XX + 1, counters[ i ] );
+    }
+    append( buf, size, len, "webserver_sent_bytes_total %ld\n", counters[ CNT_SENT_BYTES ] );
+
+    append( buf, size, len, "# TYPE webserver_stage_seconds summary\n" );
+    for ( int s = 0; s < STAGE_COUNT; ++s ) {
+        memset( buckets, 0, sizeof( buckets ) );
+        long sum = 0, max = 0, count = 0;
+        for ( thread_metrics* m = all_metrics.load( std::memory_order_acquire ); m; m = m->next ) {
+            for ( int b = 0; b < BUCKETS; ++b ) {
+                buckets[ b ] += m->buckets[ s ][ b ].load( std::memory_order_relaxed );
+            }
+            sum += m->sum[ s ].load( std::memory_order_relaxed );
+            long thread_max = m->max[ s ].load( std::memory_order_relaxed );
+            if ( thread_max > max ) {
+                max = thread_max;
+            }
+        }
+        for ( int b = 0; b < BUCKETS; ++b ) {
+            count += buckets[ b ];
+        }
+        //分位数取所在桶的上界，不超过最大值
+        int b = 0;
+        long seen = 0;
+        for ( int q = 0; q < (int)( sizeof( quantiles ) / sizeof( quantiles[ 0 ] ) ); ++q ) {
+            long rank = (long)( quantiles[ q ] * count + 0.5 );
+            if ( rank < 1 ) {
+                rank = 1;
+            }
+            while ( b < BUCKETS - 1 && seen + buckets[ b ] < rank ) {
+                seen += buckets[ b++ ];
+            }
+            long value = count ? bucket_upper( b ) : 0;
+            append( buf, size, len, "webserver_stage_seconds{stage=\"%s\",quantile=\"%g\"} %g\n",
+                    stage_names[ s ], quantiles[ q ], ( value < max ? value : max ) / 1e9 );
+        }
+        append( buf, size, len, "webserver_stage_seconds_sum{stage=\"%s\"} %g\n", stage_names[ s ], sum / 1e9 );
+        append( buf, size, len, "webserver_stage_seconds_count{stage=\"%s\"} %ld\n", stage_names[ s ], count );
+        append( buf, size, len, "webserver_stage_max_seconds{stage=\"%s\"} %g\n", stage_names[ s ], max / 1e9 );
+    }
+    return len;
+}
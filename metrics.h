@@ -0,0 +1,73 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <time.h>
+
+/*
+运行指标：计数器和各处理阶段的延迟直方图。
+每个线程只写自己的一份（不加锁、没有原子的读改写），读取时再把所有线程的加起来，
+所以记录一次只是一次clock_gettime和几次普通的内存写。
+
+直方图是HDR式的对数-线性分桶：每个2的幂区间再等分成SUB_BUCKETS个桶，
+相对误差不超过1/SUB_BUCKETS，从1ns到约18分钟只需要几百个桶。
+*/
+
+// 记录延迟的阶段
+enum METRIC_STAGE {
+    STAGE_ACCEPT = 0,   // accept返回到连接在reactor中注册完成（多reactor时包括投递到子reactor）
+    STAGE_QUEUE,        // 连接放进线程池队列到工作线程开始处理
+    STAGE_PARSE,        // 解析出一个完整的请求（最后一次process_read中查找资源之前的部分）
+    STAGE_LOOKUP,       // do_request：查找路由、缓存或文件
+    STAGE_SEND,         // 一批响应生成好到最后一个字节交给内核
+    STAGE_COUNT
+};
+
+enum METRIC_COUNTER {
+    CNT_ACCEPTED = 0,   // 接受的连接
+    CNT_REJECTED,       // 连接数已满或投递失败而直接关闭的连接
+    CNT_QUEUE_FULL,     // 线程池队列满或超过高水位而由reactor回复503的请求
+    CNT_IP_REJECTED,    // 超过单个IP的连接数上限而回复503的连接
+    CNT_ACCEPT_PAUSES,  // 因超过高水位暂停accept的次数
+    CNT_REQUESTS,       // 处理的请求
+    CNT_STATUS_1XX,     // 按状态码分类的响应，依次为1xx-5xx
+    CNT_STATUS_2XX,
+    CNT_STATUS_3XX,
+    CNT_STATUS_4XX,
+    CNT_STATUS_5XX,
+    CNT_SENT_BYTES,     // 发送的字节数
+    CNT_COUNT
+};
+
+class metrics {
+public:
+    static const int SUB_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int MAX_BITS = 40;     // 不小于2^40ns的值记在最后一个桶
+    static const int BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+    static const int MAX_GAUGES = 8;
+
+    // 单调时钟，纳秒
+    static long now() {
+        struct timespec ts;
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return ts.tv_sec * 1000000000L + ts.tv_nsec;
+    }
+    // 注册一个读取时才计算的值（如当前连接数），只能在启动时调用
+    static bool add_gauge( const char* name, long ( *func )() );
+    static void add( METRIC_COUNTER counter, long n = 1 );
+    static void record( METRIC_STAGE stage, long ns );
+    // 在开始时间非0时记录到现在的耗时
+    static void record_since( METRIC_STAGE stage, long start ) {
+        if ( start ) {
+            record( stage, now() - start );
+        }
+    }
+
+    // 汇总所有线程，按Prometheus文本格式写到buf，返回长度（超过size时截断）
+    static int format( char* buf, int size );
+
+    static int bucket_of( long ns );
+    static long bucket_upper( int bucket );    // 桶中最大的值
+};
+
+#endif
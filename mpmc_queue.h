@@ -0,0 +1,155 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <exception>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+有界无锁多生产者多消费者队列（环形数组，每个槽带序号）。
+生产者和消费者各自用CAS抢占一个位置，槽的序号表明它当前可写还是可读，
+push/pop都不加锁，也没有每次入队的内存分配。
+队列为空时消费者通过futex睡眠，生产者只在有线程睡眠时才调用futex唤醒。
+*/
+template<typename T>
+class mpmc_queue {
+public:
+    // 容量向上取整为2的幂
+    mpmc_queue(int capacity) : m_waiters(0), m_futex(0), m_closed(false) {
+        m_size = 1;
+        while (m_size < (size_t)capacity) {
+            m_size <<= 1;
+        }
+        m_mask = m_size - 1;
+        m_cells = new cell[m_size];
+        if (!m_cells) {
+            throw std::exception();
+        }
+        for (size_t i = 0; i < m_size; ++i) {
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+        m_enqueue_pos.store(0, std::memory_order_relaxed);
+        m_dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    ~mpmc_queue() {
+        delete [] m_cells;
+    }
+
+    // 队列满返回false
+    bool push(T* data) {
+        cell* c;
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        c->data = data;
+        c->seq.store(pos + 1, std::memory_order_release);
+
+        m_futex.fetch_add(1, std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_seq_cst) > 0) {
+            futex(FUTEX_WAKE_PRIVATE, 1);
+        }
+        return true;
+    }
+
+    // 队列空返回false
+    bool try_pop(T*& data) {
+        cell* c;
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        data = c->data;
+        c->seq.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 取出一个元素，队列为空时先短暂自旋，再在futex上睡眠。
+    // 醒来后仍然没有元素（被其他线程抢走或队列被close()关闭）返回NULL，由调用者决定是否继续等待
+    T* pop() {
+        T* data;
+        for (int i = 0; i < 64; ++i) {
+            if (try_pop(data)) {
+                return data;
+            }
+        }
+        int seq = m_futex.load(std::memory_order_seq_cst);
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        if (try_pop(data)) {
+            m_waiters.fetch_sub(1, std::memory_order_relaxed);
+            return data;
+        }
+        //close()先置标志再改m_futex：这里没看到标志时，seq一定是改之前的值，futex会立即返回
+        if (m_closed.load(std::memory_order_seq_cst)) {
+            m_waiters.fetch_sub(1, std::memory_order_relaxed);
+            return NULL;
+        }
+        //seq变了说明期间有新元素入队，futex会立即返回
+        futex(FUTEX_WAIT_PRIVATE, seq);
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+        if (try_pop(data)) {
+            return data;
+        }
+        return NULL;
+    }
+
+    // 关闭队列（线程池停止时）：唤醒所有睡眠的消费者，之后pop在队列空时直接返回NULL，不再睡眠
+    void close() {
+        m_closed.store(true, std::memory_order_seq_cst);
+        m_futex.fetch_add(1, std::memory_order_seq_cst);
+        futex(FUTEX_WAKE_PRIVATE, INT_MAX);
+    }
+
+private:
+    long futex(int op, int val) {
+        return syscall(SYS_futex, (int*)&m_futex, op, val, NULL, NULL, 0);
+    }
+
+private:
+    struct cell {
+        std::atomic<size_t> seq;
+        T* data;
+    };
+
+    // 生产者和消费者的位置放在不同的缓存行，避免伪共享
+    char m_pad0[64];
+    cell* m_cells;
+    size_t m_size;
+    size_t m_mask;
+    char m_pad1[64];
+    std::atomic<size_t> m_enqueue_pos;
+    char m_pad2[64];
+    std::atomic<size_t> m_dequeue_pos;
+    char m_pad3[64];
+    std::atomic<int> m_waiters;
+    std::atomic<int> m_futex;
+    std::atomic<bool> m_closed;
+};
+
+#endif
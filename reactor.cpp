@@ -0,0 +1,319 @@
+#include "reactor.h"
+#include <assert.h>
+#include <sys/timerfd.h>
+
+extern void addfd(int epollfd, int fd, bool one_shot, bool et);
+extern int setnonblocking(int fd);
+
+int reactor::m_idle_timeout = 15000;
+int reactor::m_header_timeout = 10000;
+int reactor::m_body_timeout = 10000;
+
+//定时器回调：关闭非活跃连接，连接自己知道属于哪个epoll。
+//连接正在线程池中时只做标记，由工作线程处理完后关闭
+static void cb_func( uint64_t handle ) {
+    http_conn* conn = conn_table::get( handle );
+    if ( !conn ) {
+        return;     //连接关闭时会删除定时器，不应该走到这里
+    }
+    conn->timer = NULL;  //定时器在tick中随后被释放
+    if ( conn->expire() ) {
+        LOG_DEBUG( "close fd %d", conn->getfd() );
+        conn->close_conn();
+    }
+}
+
+reactor::reactor(threadpool<http_conn>* pool, bool use_time_wheel) :
+    m_listenfd(-1), m_accept_paused(false), m_pool(pool), m_timers(NULL), m_stop(false) {
+    m_epollfd = epoll_create(5);
+    if (m_epollfd == -1){
+        throw std::exception();
+    }
+    if (pipe(m_notifyfd) == -1){
+        close(m_epollfd);
+        throw std::exception();
+    }
+    //写端非阻塞，管道满了主线程直接丢弃该连接而不是被阻塞住
+    setnonblocking(m_notifyfd[1]);
+    addfd(m_epollfd, m_notifyfd[0], false, false);
+
+    //定时器由timerfd驱动，直接注册在本reactor的epoll中，不再依赖SIGALRM
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerfd == -1){
+        close(m_notifyfd[0]);
+        close(m_notifyfd[1]);
+        close(m_epollfd);
+        throw std::exception();
+    }
+    struct itimerspec its;
+    its.it_interval.tv_sec = TIMER_TICK_MS / 1000;
+    its.it_interval.tv_nsec = (TIMER_TICK_MS % 1000) * 1000000;
+    its.it_value = its.it_interval;
+    timerfd_settime(m_timerfd, 0, &its, NULL);
+    addfd(m_epollfd, m_timerfd, false, false);
+
+    if (use_time_wheel){
+        m_timers = new time_wheel(TIMER_TICK_MS);
+    } else {
+        m_timers = new sort_timer_lst;
+    }
+}
+
+reactor::~reactor(){
+    if (m_listenfd != -1){
+        close(m_listenfd);
+    }
+    close(m_timerfd);
+    close(m_notifyfd[0]);
+    close(m_notifyfd[1]);
+    close(m_epollfd);
+    delete m_timers;
+}
+
+void reactor::add_conn(int connfd, const sockaddr_in& addr, long accepted){
+    if (!admission::admit_ip(addr.sin_addr.s_addr)){
+        metrics::add(CNT_IP_REJECTED);
+        admission::reject(connfd);
+        return;
+    }
+    uint64_t handle;
+    http_conn* conn = conn_table::acquire(handle);
+    if (!conn){
+        admission::release_ip(addr.sin_addr.s_addr);
+        metrics::add(CNT_REJECTED);
+        close(connfd);
+        return;
+    }
+    conn->init(connfd, addr, m_epollfd, handle);
+    //创建个定时器，设置回调函数和超时事件，绑定到用户上，并加入链接中。
+    util_timer* timer = new util_timer;
+    timer->user_data = handle;
+    timer->cb_func = cb_func;
+    timer->expire = timer_now_ms() + m_idle_timeout;
+    conn->timer = timer;
+    m_timers->add_timer( timer );
+    metrics::add(CNT_ACCEPTED);
+    metrics::record_since(STAGE_ACCEPT, accepted);
+}
+
+bool reactor::dispatch(int connfd, const sockaddr_in& addr, long accepted){
+    conn_msg msg;
+    msg.connfd = connfd;
+    msg.addr = addr;
+    msg.accepted = accepted;
+    //小于PIPE_BUF的写是原子的，不会和其他消息交错
+    return ::write(m_notifyfd[1], &msg, sizeof(msg)) == sizeof(msg);
+}
+
+void reactor::handle_notify(){
+    conn_msg msgs[64];
+    while (true) {
+        int len = ::read(m_notifyfd[0], msgs, sizeof(msgs));
+        if (len <= 0){
+            break;
+        }
+        for (int i = 0; i < len / (int)sizeof(conn_msg); ++i){
+            if (msgs[i].connfd == -1){
+                m_stop.store(true, std::memory_order_relaxed);
+                continue;
+            }
+            add_conn(msgs[i].connfd, msgs[i].addr, msgs[i].accepted);
+        }
+        if (len < (int)sizeof(msgs)){
+            break;
+        }
+    }
+}
+
+bool reactor::listen_on(int port, int backlog){
+    m_listenfd = open_listenfd(port, backlog, true);
+    if (m_listenfd == -1){
+        return false;
+    }
+    addfd(m_epollfd, m_listenfd, false, false);
+    return true;
+}
+
+void reactor::handle_accept(){
+    //一次就绪把全连接队列取空，减少epoll_wait次数；过载时暂停，剩下的留在全连接队列里
+    while (true) {
+        if (admission::overloaded(m_pool->pending())){
+            admission::pause_accept(m_epollfd, m_listenfd);
+            m_accept_paused = true;
+            break;
+        }
+        struct sockaddr_in client_address;
+        socklen_t client_addrlen = sizeof(client_address);
+        int connfd = accept4(m_listenfd, (struct sockaddr*)&client_address, &client_addrlen, SOCK_NONBLOCK);
+        if (connfd < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            break;  //EAGAIN：队列已空；其他错误留给下次就绪再处理
+        }
+        add_conn(connfd, client_address, metrics::now());
+    }
+}
+
+void reactor::close_conn(http_conn* conn){
+    util_timer* timer = conn->timer;
+    if (timer){
+        m_timers->del_timer(timer);
+        conn->timer = NULL;
+    }
+    conn->close_conn();
+}
+
+//交给线程池。排队的任务超过高水位时新请求直接在这里拒绝，不再排到队尾；
+//已经在接收请求体的请求继续处理，除非队列已满。
+//socket是EPOLLONESHOT的，入队失败就不会再被触发，只能关闭
+void reactor::submit(http_conn* conn){
+    if (admission::m_max_queue > 0 && m_pool->pending() >= admission::m_max_queue
+        && conn->phase() != http_conn::PHASE_BODY){
+        shed(conn);
+        return;
+    }
+    conn->to_worker();
+    if (!m_pool->append(conn)) {
+        conn->to_reactor();
+        shed(conn);
+    }
+}
+
+//过载时由reactor直接回复503，请求不经过工作线程
+void reactor::shed(http_conn* conn){
+    metrics::add(CNT_QUEUE_FULL);
+    admission::send_503(conn->getfd());
+    close_conn(conn);
+}
+
+void reactor::set_timeout(http_conn* conn, int timeout){
+    util_timer* timer = conn->timer;
+    if( timer ) {
+        timer->expire = timer_now_ms() + timeout;
+        m_timers->adjust_timer( timer );
+    }
+}
+
+void reactor::handle_event(uint64_t data, uint32_t events){
+    if (!conn_table::is_handle(data)){
+        if ((int)data == m_timerfd){
+            uint64_t expirations;
+            ::read(m_timerfd, &expirations, sizeof(expirations));
+            tick();
+        }
+        return;
+    }
+    //句柄已失效说明连接在这批事件中已被关闭。确认归属之后再查一次：
+    //连接若被工作线程关闭，槽位可能已经分配给了新连接
+    http_conn* conn = conn_table::get(data);
+    if (!conn || !conn->owned_by_reactor() || !conn_table::get(data)){
+        return;
+    }
+    if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+        close_conn(conn);
+    } else if (events & EPOLLIN){
+        http_conn::CONN_PHASE before = conn->phase();
+        if (conn->read()){
+            //头部的期限从请求的第一个字节开始计算，之后的读不再延长，防止slowloris慢速发送头部；
+            //请求体则按两次读之间的间隔计算
+            http_conn::CONN_PHASE after = conn->phase();
+            if (after == http_conn::PHASE_BODY) {
+                set_timeout(conn, m_body_timeout);
+            } else if (after == http_conn::PHASE_HEADER && before == http_conn::PHASE_IDLE) {
+                set_timeout(conn, m_header_timeout);
+            }
+            //将http_conn指针传入工作线程，线程池。
+            submit(conn);
+        } else {
+            close_conn(conn);
+        }
+    } else if (events & EPOLLOUT){
+        if (!conn->write()) {
+            close_conn(conn);
+        } else {
+            //发送有进展或保活连接回到空闲，都重新计算空闲超时
+            set_timeout(conn, m_idle_timeout);
+            //流水线中还有已读入的请求，不等新数据直接交给线程池
+            if (conn->need_process()){
+                submit(conn);
+            }
+        }
+    }
+}
+
+void reactor::tick(){
+    m_timers->tick();
+}
+
+void reactor::start(){
+    if (pthread_create(&m_thread, NULL, worker, this) != 0){
+        throw std::exception();
+    }
+}
+
+void reactor::stop(){
+    //先置退出标志，再用connfd为-1的消息唤醒reactor线程。消息只是为了让它立即醒来，
+    //写失败（如管道已满）也不要紧：timerfd每TIMER_TICK_MS唤醒一次，循环开头会看到标志
+    m_stop.store(true, std::memory_order_release);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    dispatch(-1, addr, 0);
+    pthread_join(m_thread, NULL);
+}
+
+void* reactor::worker(void* arg){
+    reactor* r = (reactor*) arg;
+    r->run();
+    return r;
+}
+
+void reactor::run(){
+    epoll_event events[MAX_EVENTS_NUM];
+    while (!m_stop.load(std::memory_order_acquire)) {
+        int num = epoll_wait(m_epollfd, events, MAX_EVENTS_NUM, -1);
+        if (num < 0 && errno != EINTR){
+            break;
+        }
+        for (int i = 0; i < num; i++){
+            uint64_t data = events[i].data.u64;
+            if (data == (uint64_t)m_notifyfd[0]){
+                handle_notify();
+            } else if (m_listenfd != -1 && data == (uint64_t)m_listenfd){
+                handle_accept();
+            } else {
+                handle_event(data, events[i].events);
+            }
+        }
+        //timerfd每TIMER_TICK_MS唤醒一次，暂停accept后最多这么久检查一次能否恢复
+        if (m_accept_paused && admission::recovered(m_pool->pending())){
+            admission::resume_accept(m_epollfd, m_listenfd);
+            m_accept_paused = false;
+        }
+    }
+}
+
+int open_listenfd(int port, int backlog, bool reuseport){
+    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (listenfd == -1){
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (reuseport){
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+    }
+
+    //绑定
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+    if (bind(listenfd, (struct sockaddr*)&address, sizeof(address)) == -1
+        || listen(listenfd, backlog) == -1){
+        close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
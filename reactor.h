@@ -0,0 +1,86 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <atomic>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include "threadpool.h"
+#include "http_conn.h"
+#include "lst_timer.h"
+#include "time_wheel.h"
+#include "admission.h"
+
+#define TIMER_TICK_MS 100   //定时器tick间隔，超时精度
+#define MAX_EVENTS_NUM 10000   //最大监听数量
+
+/*
+一个reactor就是一个独立的事件循环：自己的epoll实例、自己的定时器容器（升序链表或时间轮）
+和驱动定时器的timerfd，
+以及它所管理的那部分连接（连接只会属于一个reactor，所以各reactor之间互不干扰）。
+连接放在conn_table中，epoll事件和定时器通过句柄找到连接。
+单reactor模式下主线程直接使用它处理连接事件；多reactor模式下主线程只负责accept，
+通过通知管道把新连接交给子reactor线程，子reactor负责该连接后续所有的读写和超时。
+SO_REUSEPORT模式下每个子reactor还拥有自己的监听socket，由内核在各监听socket之间分配新连接，
+子reactor自己accept，不再经过主线程。
+*/
+class reactor {
+public:
+    //超时时间（毫秒）：保活空闲、接收完整头部的期限、请求体两次读之间的最大间隔
+    static int m_idle_timeout;
+    static int m_header_timeout;
+    static int m_body_timeout;
+
+    reactor(threadpool<http_conn>* pool, bool use_time_wheel);
+    ~reactor();
+
+    int get_epollfd() { return m_epollfd; }
+
+    //在当前线程注册一个新连接（包括创建定时器），accepted为accept返回的时间
+    void add_conn(int connfd, const sockaddr_in& addr, long accepted);
+    //跨线程投递新连接，由reactor所在线程完成注册
+    bool dispatch(int connfd, const sockaddr_in& addr, long accepted);
+    //处理一个连接或timerfd上的就绪事件，data为epoll_event的data.u64
+    void handle_event(uint64_t data, uint32_t events);
+
+    //创建本reactor私有的SO_REUSEPORT监听socket
+    bool listen_on(int port, int backlog);
+
+    //启动/停止子reactor线程
+    void start();
+    void stop();
+
+private:
+    static void* worker(void* arg);
+    void run();
+    void handle_notify();
+    void handle_accept();
+    void close_conn(http_conn* conn);
+    void submit(http_conn* conn);
+    void shed(http_conn* conn);
+    void tick();
+    void set_timeout(http_conn* conn, int timeout);
+
+private:
+    //通过通知管道传递的新连接
+    struct conn_msg {
+        int connfd;
+        sockaddr_in addr;
+        long accepted;
+    };
+
+    int m_epollfd;
+    int m_notifyfd[2];          //[0]由reactor线程读，[1]由主线程写
+    int m_listenfd;             //SO_REUSEPORT模式下的私有监听socket，否则为-1
+    bool m_accept_paused;       //过载时暂停了m_listenfd上的accept
+    int m_timerfd;              //每TIMER_TICK_MS触发一次
+    threadpool<http_conn>* m_pool;
+    timer_container* m_timers;
+    pthread_t m_thread;
+    std::atomic<bool> m_stop;   //主线程设置，reactor线程每轮循环检查
+};
+
+//创建监听socket，reuseport为true时允许多个socket绑定同一端口
+int open_listenfd(int port, int backlog, bool reuseport);
+
+#endif
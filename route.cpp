@@ -0,0 +1,173 @@
+#include "route.h"
+#include <stdarg.h>
+#include <string.h>
+#include <map>
+#include "http_conn.h"
+#include "metrics.h"
+
+route_response::route_response(http_conn* conn) :
+    m_conn(conn), m_status(200), m_type("text/html"), m_headers_len(0) {
+}
+
+//"name: value\r\n"记到m_headers中，超过HEADERS_LEN返回false
+bool route_response::add_header(const char* name, const char* value){
+    int len = snprintf(m_headers + m_headers_len, HEADERS_LEN - m_headers_len, "%s: %s\r\n", name, value);
+    if (len < 0 || len >= HEADERS_LEN - m_headers_len){
+        m_headers[m_headers_len] = '\0';
+        return false;
+    }
+    m_headers_len += len;
+    return true;
+}
+
+bool route_response::write(const char* data, int len){
+    return m_conn->add_bytes(data, len);
+}
+
+bool route_response::printf(const char* format, ...){
+    char buf[1024];
+    va_list arg_list;
+    va_start(arg_list, format);
+    int len = vsnprintf(buf, sizeof(buf), format, arg_list);
+    va_end(arg_list);
+    if (len < 0){
+        return false;
+    }
+    if (len < (int)sizeof(buf)){
+        return m_conn->add_bytes(buf, len);
+    }
+    //超过栈上缓冲区的长内容直接格式化进写缓冲区
+    va_start(arg_list, format);
+    bool ret = m_conn->add_vresponse(format, arg_list);
+    va_end(arg_list);
+    return ret;
+}
+
+route_table::route_table(){
+}
+
+//同一路径的精确路由和前缀路由是两条不同的路由
+route& route_table::entry(const char* path, bool prefix){
+    for (size_t i = 0; i < m_pending.size(); ++i){
+        if (m_pending[i].prefix == prefix && m_pending[i].path == path){
+            return m_pending[i].r;
+        }
+    }
+    pending p;
+    p.path = path;
+    p.prefix = prefix;
+    p.r.get = NULL;
+    p.r.post = NULL;
+    m_pending.push_back(p);
+    return m_pending.back().r;
+}
+
+void route_table::add_get(const char* path, route_func func, bool prefix){
+    entry(path, prefix).get = func;
+}
+
+void route_table::add_post(const char* path, post_handler* handler, bool prefix){
+    entry(path, prefix).post = handler;
+}
+
+/*
+先建一棵普通的字典树，再按层序展开到m_nodes，使每个节点的子节点连续存放、按字符排序。
+查找时只在这个数组上走，不需要分配内存
+*/
+void route_table::compile(){
+    struct build_node {
+        std::map<unsigned char, int> children;
+        int exact;
+        int prefix;
+    };
+    std::vector<build_node> tree(1);
+    tree[0].exact = tree[0].prefix = -1;
+    m_routes.clear();
+    for (size_t i = 0; i < m_pending.size(); ++i){
+        const std::string& path = m_pending[i].path;
+        int node = 0;
+        for (size_t j = 0; j < path.size(); ++j){
+            unsigned char c = path[j];
+            std::map<unsigned char, int>::iterator it = tree[node].children.find(c);
+            if (it != tree[node].children.end()){
+                node = it->second;
+                continue;
+            }
+            build_node child;
+            child.exact = child.prefix = -1;
+            tree.push_back(child);
+            tree[node].children[c] = tree.size() - 1;
+            node = tree.size() - 1;
+        }
+        (m_pending[i].prefix ? tree[node].prefix : tree[node].exact) = m_routes.size();
+        m_routes.push_back(m_pending[i].r);
+    }
+
+    m_nodes.clear();
+    std::vector<int> order(1, 0);  //层序中第i个节点在tree中的下标
+    trie_node root;
+    root.ch = 0;
+    m_nodes.push_back(root);
+    for (size_t i = 0; i < order.size(); ++i){
+        build_node& b = tree[order[i]];
+        m_nodes[i].exact = b.exact;
+        m_nodes[i].prefix = b.prefix;
+        m_nodes[i].first_child = m_nodes.size();
+        m_nodes[i].child_count = b.children.size();
+        for (std::map<unsigned char, int>::iterator it = b.children.begin(); it != b.children.end(); ++it){
+            trie_node child;
+            child.ch = it->first;
+            m_nodes.push_back(child);
+            order.push_back(it->second);
+        }
+    }
+}
+
+const route* route_table::find(const char* path, int& matched_len) const{
+    if (m_nodes.empty()){
+        return NULL;
+    }
+    const trie_node* nodes = &m_nodes[0];
+    const trie_node* node = nodes;
+    const route* best = NULL;
+    if (node->prefix >= 0){
+        best = &m_routes[node->prefix];
+        matched_len = 0;
+    }
+    int i = 0;
+    for (; path[i] != '\0' && path[i] != '?'; ++i){
+        //子节点很少，顺序查找
+        const trie_node* child = nodes + node->first_child;
+        const trie_node* end = child + node->child_count;
+        while (child < end && child->ch != (unsigned char)path[i]){
+            ++child;
+        }
+        if (child == end){
+            return best;
+        }
+        node = child;
+        if (node->prefix >= 0){
+            best = &m_routes[node->prefix];
+            matched_len = i + 1;
+        }
+    }
+    if (node->exact >= 0){
+        matched_len = i;
+        return &m_routes[node->exact];
+    }
+    return best;
+}
+
+bool health_route(const route_request&, route_response& resp){
+    resp.set_content_type("text/plain");
+    resp.add_header("Cache-Control", "no-store");
+    return resp.write("ok\n", 3);
+}
+
+bool metrics_route(const route_request&, route_response& resp){
+    char buf[8192];
+    int len = metrics::format(buf, sizeof(buf));
+    resp.set_content_type("text/plain; version=0.0.4");
+    resp.add_header("Cache-Control", "no-store");
+    return resp.write(buf, len);
+}
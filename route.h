@@ -0,0 +1,101 @@
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include <string>
+#include <vector>
+#include "http_scan.h"
+
+/*
+动态接口的路由表：按路径把请求交给处理函数，没有匹配的路由时按静态文件处理。
+路由在启动时注册并编译成字典树，之后只读，工作线程查找时不加锁也不分配内存。
+*/
+
+class http_conn;
+class post_handler;
+
+// 动态接口的请求，各个视图都指向连接的读缓冲区，只在处理函数执行期间有效
+struct route_request {
+    http_conn* conn;        // 用get_header读取请求头部
+    str_view path;          // 不含查询串
+    str_view query;         // '?'之后的部分，没有时len为0
+    str_view rest;          // 前缀路由中path在前缀之后的部分，精确路由为空
+};
+
+/*
+处理函数通过它生成响应：状态码、Content-Type和额外的头部先记在这里，
+内容直接写进连接的写缓冲区，处理函数返回后再在前面补上响应头
+*/
+class route_response {
+public:
+    static const int HEADERS_LEN = 512;   //额外头部的总长度上限
+
+    route_response(http_conn* conn);
+    void set_status(int status) { m_status = status; }
+    void set_content_type(const char* type) { m_type = type; }  //默认text/html，type需一直有效
+    bool add_header(const char* name, const char* value);
+    bool write(const char* data, int len);
+    bool printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+    int status() const { return m_status; }
+    const char* content_type() const { return m_type; }
+    const char* headers() const { return m_headers; }
+    int headers_len() const { return m_headers_len; }
+
+private:
+    http_conn* m_conn;
+    int m_status;
+    const char* m_type;
+    char m_headers[HEADERS_LEN];
+    int m_headers_len;
+};
+
+// 返回false表示处理失败，已写入的内容丢弃，回复500
+typedef bool (*route_func)(const route_request& req, route_response& resp);
+
+// 一个路径上注册的处理函数，没有注册的方法回复405
+struct route {
+    route_func get;
+    post_handler* post;     // POST的请求体流式交给它
+};
+
+class route_table {
+public:
+    route_table();
+    // 注册路由，prefix为true时匹配以path开头的所有路径。都要在compile之前调用
+    void add_get(const char* path, route_func func, bool prefix = false);
+    void add_post(const char* path, post_handler* handler, bool prefix = false);
+    // 把注册的路由编译成字典树
+    void compile();
+    /*
+    按路径（到'?'为止）查找，精确路由优先，其次是最长的前缀路由，没有返回NULL。
+    matched_len返回匹配的长度，前缀路由的rest从这里开始
+    */
+    const route* find(const char* path, int& matched_len) const;
+
+private:
+    route& entry(const char* path, bool prefix);
+
+    // 字典树的节点，一个节点的子节点在m_nodes中连续存放
+    struct trie_node {
+        unsigned char ch;       // 从父节点到这里的字符
+        int first_child;
+        int child_count;
+        int exact;              // 以该节点结束的精确路由在m_routes中的下标，-1表示没有
+        int prefix;             // 前缀路由
+    };
+    struct pending {
+        std::string path;
+        bool prefix;
+        route r;
+    };
+    std::vector<pending> m_pending;   // 注册了还没有编译的路由
+    std::vector<route> m_routes;
+    std::vector<trie_node> m_nodes;   // m_nodes[0]为根
+};
+
+// 示例：健康检查，回复"ok"
+bool health_route(const route_request& req, route_response& resp);
+// 运行指标，Prometheus文本格式（metrics.h）
+bool metrics_route(const route_request& req, route_response& resp);
+
+#endif
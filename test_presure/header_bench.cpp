@@ -0,0 +1,88 @@
+/*
+响应头构造微基准：每个头部一次vsnprintf vs 预格式化片段+memcpy
+两种方式生成同样的"200 OK + Content-Length + Content-Type + Connection"响应头。
+编译运行：
+    g++ -O2 header_bench.cpp -o header_bench && ./header_bench
+*/
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "../http_header.h"
+
+static const int WRITE_BUFFER_SIZE = 2048;
+static char write_buf[WRITE_BUFFER_SIZE];
+static int write_idx;
+
+static bool add_response( const char* format, ... ) {
+    va_list arg_list;
+    va_start( arg_list, format );
+    int len = vsnprintf( write_buf + write_idx, WRITE_BUFFER_SIZE - 1 - write_idx, format, arg_list );
+    va_end( arg_list );
+    if( len >= ( WRITE_BUFFER_SIZE - 1 - write_idx ) ) {
+        return false;
+    }
+    write_idx += len;
+    return true;
+}
+
+static void build_printf( int content_len, bool linger ) {
+    write_idx = 0;
+    add_response( "%s %d %s\r\n", "HTTP/1.1", 200, "OK" );
+    add_response( "Content-Length: %d\r\n", content_len );
+    add_response( "Content-Type:%s\r\n", "text/html" );
+    add_response( "Connection: %s\r\n", linger ? "keep-alive" : "close" );
+    add_response( "%s", "\r\n" );
+}
+
+static void add_bytes( const header_span& span ) {
+    memcpy( write_buf + write_idx, span.data, span.len );
+    write_idx += span.len;
+}
+
+static void build_span( int content_len, bool linger ) {
+    write_idx = 0;
+    add_bytes( *status_line_span( 200 ) );
+    add_bytes( CONTENT_LENGTH );
+    write_idx += fast_itoa( content_len, write_buf + write_idx );
+    add_bytes( CRLF );
+    add_bytes( CONTENT_TYPE_HTML );
+    add_bytes( linger ? CONNECTION_KEEP_ALIVE : CONNECTION_CLOSE );
+    add_bytes( CRLF );
+}
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main() {
+    const int rounds = 5000000;
+    unsigned long check = 0;
+
+    double start = now_ns();
+    for( int i = 0; i < rounds; ++i ) {
+        build_printf( i & 0xfffff, i & 1 );
+        check += write_idx;
+    }
+    double printf_ns = ( now_ns() - start ) / rounds;
+    char expect[WRITE_BUFFER_SIZE];
+    build_printf( 762013, true );
+    memcpy( expect, write_buf, write_idx );
+    int expect_len = write_idx;
+
+    start = now_ns();
+    for( int i = 0; i < rounds; ++i ) {
+        build_span( i & 0xfffff, i & 1 );
+        check -= write_idx;
+    }
+    double span_ns = ( now_ns() - start ) / rounds;
+    build_span( 762013, true );
+    bool same = ( expect_len == write_idx ) && memcmp( expect, write_buf, write_idx ) == 0;
+
+    printf( "vsnprintf per header: %6.1f ns/response\n", printf_ns );
+    printf( "preformatted spans:   %6.1f ns/response\n", span_ns );
+    printf( "output identical: %s, checksum %lu\n", ( same && check == 0 ) ? "yes" : "NO", check );
+    return 0;
+}
@@ -0,0 +1,127 @@
+/*
+保活连接压测：建立若干个keep-alive连接，每个连接上同一时刻只有一个请求，
+收到完整响应（按Content-Length判断）后立即发下一个，统计每秒完成的请求数。
+用来对比每个请求周期中连接重置的开销，请求的文件越小，这部分开销占比越大。
+响应不能超过64KB。
+编译运行：
+    g++ -O2 keepalive_bench.cpp -o keepalive_bench
+    ./keepalive_bench 127.0.0.1 10000 [连接数=100] [秒数=10] [路径=/index.html]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+struct client {
+    int fd;
+    char buf[65536];
+    int len;
+};
+
+static char request[512];
+static int request_len;
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 缓冲区中有一个完整响应时返回它的长度，否则返回0，格式错误返回-1
+static int response_len( const char* buf, int len ) {
+    const char* end = ( const char* )memmem( buf, len, "\r\n\r\n", 4 );
+    if( !end ) {
+        return 0;
+    }
+    const char* cl = ( const char* )memmem( buf, end - buf, "Content-Length:", 15 );
+    if( !cl ) {
+        return -1;
+    }
+    int total = end + 4 - buf + atoi( cl + 15 );
+    return len >= total ? total : 0;
+}
+
+static bool send_request( client* c ) {
+    return send( c->fd, request, request_len, 0 ) == request_len;
+}
+
+int main( int argc, char* argv[] ) {
+    if( argc < 3 ) {
+        printf( "usage: %s ip port [conns] [seconds] [path]\n", argv[0] );
+        return 1;
+    }
+    int conns = argc > 3 ? atoi( argv[3] ) : 100;
+    int seconds = argc > 4 ? atoi( argv[4] ) : 10;
+    const char* path = argc > 5 ? argv[5] : "/index.html";
+    request_len = snprintf( request, sizeof( request ),
+        "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n", path, argv[1] );
+
+    struct sockaddr_in addr;
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( atoi( argv[2] ) );
+    inet_pton( AF_INET, argv[1], &addr.sin_addr );
+
+    int epollfd = epoll_create( 5 );
+    client* clients = new client[conns];
+    for( int i = 0; i < conns; ++i ) {
+        clients[i].fd = socket( PF_INET, SOCK_STREAM, 0 );
+        clients[i].len = 0;
+        if( connect( clients[i].fd, ( struct sockaddr* )&addr, sizeof( addr ) ) < 0 ) {
+            perror( "connect" );
+            return 1;
+        }
+        int nodelay = 1;
+        setsockopt( clients[i].fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof( nodelay ) );
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = &clients[i];
+        epoll_ctl( epollfd, EPOLL_CTL_ADD, clients[i].fd, &event );
+        send_request( &clients[i] );
+    }
+
+    long done = 0, failed = 0;
+    int alive = conns;
+    epoll_event events[1024];
+    double start = now_sec();
+    double stop = start + seconds;
+    while( alive > 0 && now_sec() < stop ) {
+        int n = epoll_wait( epollfd, events, 1024, 100 );
+        for( int i = 0; i < n; ++i ) {
+            client* c = ( client* )events[i].data.ptr;
+            int r = recv( c->fd, c->buf + c->len, sizeof( c->buf ) - c->len, 0 );
+            if( r <= 0 ) {
+                //服务器关闭了连接
+                ++failed;
+                --alive;
+                epoll_ctl( epollfd, EPOLL_CTL_DEL, c->fd, NULL );
+                close( c->fd );
+                continue;
+            }
+            c->len += r;
+            int total;
+            while( ( total = response_len( c->buf, c->len ) ) > 0 ) {
+                ++done;
+                memmove( c->buf, c->buf + total, c->len - total );
+                c->len -= total;
+                send_request( c );
+            }
+            if( total < 0 ) {
+                fprintf( stderr, "bad response\n" );
+                return 1;
+            }
+        }
+    }
+    double cost = now_sec() - start;
+    printf( "%d conns, %.1fs: %ld requests, %.0f requests/sec, %ld connections closed by server\n",
+            conns, cost, done, done / cost, failed );
+    return 0;
+}
@@ -0,0 +1,88 @@
+/*
+日志微基准：同步printf vs 异步日志
+几个线程同时打印和"got 1 http line"相同的日志，统计每次调用的耗时：
+1. printf后fflush（终端等行缓冲输出时每行一次write）
+2. printf全缓冲（只有stdio锁的竞争）
+3. 异步日志LOG_INFO（每个线程的环形缓冲区，后台线程批量写出）
+4. 运行时被过滤掉的LOG_DEBUG
+输出都写到/dev/null。
+编译运行：
+    g++ -O2 log_bench.cpp ../log.cpp -o log_bench -pthread && ./log_bench
+*/
+#include <stdio.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../log.h"
+
+static const int CALLS = 256 * 400;
+static const char* line = "Host: 127.0.0.1:10000";
+static int mode;
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void log_once() {
+    switch( mode ) {
+        case 0:
+            printf( "got 1 http line : %s \n", line );
+            fflush( stdout );
+            break;
+        case 1:
+            printf( "got 1 http line : %s \n", line );
+            break;
+        case 2:
+            LOG_INFO( "got 1 http line : %s", line );
+            break;
+        default:
+            LOG_DEBUG( "got 1 http line : %s", line );
+            break;
+    }
+}
+
+// 每256次调用计一次时，之间停顿200us模拟两次日志之间的其他工作（后台线程在这时写出），停顿不计入耗时
+static void* run( void* arg ) {
+    double* cost = ( double* )arg;
+    *cost = 0;
+    for( int i = 0; i < CALLS; i += 256 ) {
+        double start = now_ns();
+        for( int j = 0; j < 256; ++j ) {
+            log_once();
+        }
+        *cost += now_ns() - start;
+        usleep( 200 );
+    }
+    return NULL;
+}
+
+static const char* mode_names[] = { "printf+fflush", "printf buffered", "async LOG_INFO", "filtered LOG_DEBUG" };
+
+int main() {
+    int null_fd = open( "/dev/null", O_WRONLY );
+    freopen( "/dev/null", "w", stdout );
+    logger::start( null_fd, LOG_LEVEL_INFO );
+    int thread_numbers[] = { 1, 2, 4 };
+    for( int t = 0; t < 3; ++t ) {
+        for( mode = 0; mode < 4; ++mode ) {
+            long dropped = logger::dropped();
+            pthread_t threads[4];
+            double costs[4];
+            for( int i = 0; i < thread_numbers[t]; ++i ) {
+                pthread_create( &threads[i], NULL, run, &costs[i] );
+            }
+            double cost = 0;
+            for( int i = 0; i < thread_numbers[t]; ++i ) {
+                pthread_join( threads[i], NULL );
+                cost += costs[i] / CALLS / thread_numbers[t];
+            }
+            fprintf( stderr, "threads=%d %-18s %8.1f ns/call (per thread), dropped %ld\n",
+                     thread_numbers[t], mode_names[mode], cost, logger::dropped() - dropped );
+        }
+    }
+    logger::stop();
+    return 0;
+}
@@ -0,0 +1,68 @@
+/*
+线程池任务队列微基准：互斥锁+链表+信号量 vs 无锁环形队列 vs 每线程队列+工作窃取
+主线程模拟reactor不停地append空任务，统计不同工作线程数下每秒处理的任务数。
+每组测试在单独的子进程中运行，结束时析构线程池，等所有工作线程退出（可以加-fsanitize=address检查停止过程）。
+编译运行：
+    g++ -O2 threadpool_bench.cpp ../log.cpp ../metrics.cpp -o threadpool_bench -pthread && ./threadpool_bench
+*/
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <atomic>
+#include "../threadpool.h"
+
+static std::atomic<long> done( 0 );
+
+struct task {
+    task() : worker( -1 ), queued_at( 0 ) {}
+    int worker;
+    long queued_at;
+    void process() {
+        done.fetch_add( 1, std::memory_order_relaxed );
+    }
+};
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char* mode_names[] = { "mutex", "lock-free", "stealing" };
+
+static void bench( int thread_number, QUEUE_MODE mode ) {
+    const long tasks = 2000000;
+    // 模拟1024个连接，工作窃取模式下每个连接会粘在上次处理它的线程上
+    static task conns[1024];
+    threadpool<task> pool( thread_number, 10000, mode );
+    double start = now_sec();
+    for( long i = 0; i < tasks; ) {
+        if( pool.append( &conns[i & 1023] ) ) {
+            ++i;
+        }
+    }
+    while( done.load( std::memory_order_relaxed ) < tasks ) {
+        sched_yield();
+    }
+    double cost = now_sec() - start;
+    fprintf( stderr, "%-10s threads=%-3d %12.0f tasks/sec\n",
+             mode_names[mode], thread_number, tasks / cost );
+}
+
+int main() {
+    int thread_numbers[] = { 1, 2, 4, 8 };
+    for( int i = 0; i < 4; ++i ) {
+        for( int mode = QUEUE_LOCKED; mode <= QUEUE_WORK_STEALING; ++mode ) {
+            pid_t pid = fork();
+            if( pid == 0 ) {
+                // 线程池创建线程时会打印，只保留结果
+                freopen( "/dev/null", "w", stdout );
+                bench( thread_numbers[i], ( QUEUE_MODE )mode );
+                _exit( 0 );
+            }
+            waitpid( pid, NULL, 0 );
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,69 @@
+/*
+定时器容器微基准：升序链表 vs 分层时间轮
+模拟N个保活连接，测量添加、刷新（每次读到数据后延长超时）和删除的平均耗时。
+编译运行：
+    g++ -O2 timer_bench.cpp -o timer_bench && ./timer_bench
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#include "../lst_timer.h"
+#include "../time_wheel.h"
+
+static void cb_func( uint64_t ) {}
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench( const char* name, timer_container* container, int conn_num, int refresh_num ) {
+    std::vector<util_timer*> timers( conn_num );
+    time_t cur = timer_now_ms();
+
+    // 按到期时间从晚到早添加，链表每次都插在头部，避免建表本身就是O(n^2)
+    double start = now_ns();
+    for( int i = 0; i < conn_num; ++i ) {
+        util_timer* timer = new util_timer;
+        timer->cb_func = cb_func;
+        timer->user_data = 0;
+        timer->expire = cur + 15000 + ( conn_num - i ) * 10;
+        timers[i] = timer;
+        container->add_timer( timer );
+    }
+    double add_ns = ( now_ns() - start ) / conn_num;
+
+    // 随机选连接刷新超时，超时时间只会延长
+    srand( 1 );
+    time_t expire = cur + 15000 + conn_num * 10;
+    start = now_ns();
+    for( int i = 0; i < refresh_num; ++i ) {
+        util_timer* timer = timers[rand() % conn_num];
+        timer->expire = expire + i;
+        container->adjust_timer( timer );
+    }
+    double refresh_ns = ( now_ns() - start ) / refresh_num;
+
+    start = now_ns();
+    for( int i = 0; i < conn_num; ++i ) {
+        container->del_timer( timers[i] );
+    }
+    double del_ns = ( now_ns() - start ) / conn_num;
+
+    printf( "%-16s conns=%-7d add %10.1f ns  refresh %12.1f ns  del %8.1f ns\n",
+            name, conn_num, add_ns, refresh_ns, del_ns );
+}
+
+int main() {
+    int conn_nums[] = { 10000, 100000 };
+    for( int i = 0; i < 2; ++i ) {
+        int conn_num = conn_nums[i];
+        sort_timer_lst lst;
+        bench( "sort_timer_lst", &lst, conn_num, 2000 );
+        time_wheel wheel( 100 );
+        bench( "time_wheel", &wheel, conn_num, 1000000 );
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+/*
+定时器容器的正确性测试：升序链表和时间轮都要支持把超时时间改短（头部、请求体的期限比空闲超时短）。
+几个定时器按不同的远期时间加入后，把其中一部分改到几十毫秒后，等过了时间轮的一个单位再tick，应该正好触发这些，
+其余的（包括被延长的）都不触发，之后删除剩下的定时器链表仍然完整。
+编译运行：
+    g++ -O2 timer_test.cpp -o timer_test && ./timer_test
+*/
+#include <stdio.h>
+#include <unistd.h>
+#include "../lst_timer.h"
+#include "../time_wheel.h"
+
+static const int N = 6;
+static bool fired[ N ];
+
+static void cb_func( uint64_t data ) {
+    fired[ data ] = true;
+}
+
+static bool run( const char* name, timer_container* container ) {
+    time_t cur = timer_now_ms();
+    util_timer* timers[ N ];
+    for( int i = 0; i < N; ++i ) {
+        fired[ i ] = false;
+        timers[ i ] = new util_timer;
+        timers[ i ]->cb_func = cb_func;
+        timers[ i ]->user_data = i;
+        timers[ i ]->expire = cur + 10000 * ( i + 1 );
+        container->add_timer( timers[ i ] );
+    }
+    // 尾部、中间各改短一个，一个改短但仍在最前面的之后，一个延长
+    bool expect[ N ] = { false, false, true, false, false, true };
+    timers[ 5 ]->expire = cur + 50;
+    container->adjust_timer( timers[ 5 ] );
+    timers[ 2 ]->expire = cur + 50;
+    container->adjust_timer( timers[ 2 ] );
+    timers[ 4 ]->expire = cur + 15000;
+    container->adjust_timer( timers[ 4 ] );
+    timers[ 0 ]->expire = cur + 100000;
+    container->adjust_timer( timers[ 0 ] );
+    usleep( 300000 );
+    container->tick();
+
+    bool ok = true;
+    for( int i = 0; i < N; ++i ) {
+        if( fired[ i ] != expect[ i ] ) {
+            printf( "%s: timer %d %s\n", name, i, fired[ i ] ? "fired early" : "did not fire" );
+            ok = false;
+        }
+    }
+    for( int i = 0; i < N; ++i ) {
+        if( !expect[ i ] ) {
+            container->del_timer( timers[ i ] );
+        }
+    }
+    printf( "%-16s %s\n", name, ok ? "OK" : "FAIL" );
+    return ok;
+}
+
+int main() {
+    sort_timer_lst lst;
+    time_wheel wheel( 100 );
+    bool ok = run( "sort_timer_lst", &lst );
+    ok = run( "time_wheel", &wheel ) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+/*
+大请求体上传测试：头部和请求体一次性发出（大部分会和头部一起到达服务器），
+分别用Content-Length和chunked上传不同大小的请求体到/upload，
+检查回复的"received N bytes"，然后在同一个连接上再发一个GET确认连接仍然可用。
+超过读缓冲区上限（64KB）的请求体必须流式接收，不能因为缓冲区满而断开连接。
+编译运行：
+    g++ -O2 upload_test.cpp -o upload_test
+    ./upload_test 127.0.0.1 10000
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static sockaddr_in server_addr;
+
+static int connect_server() {
+    int fd = socket( AF_INET, SOCK_STREAM, 0 );
+    struct timeval tv = { 5, 0 };
+    setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+    if ( connect( fd, ( sockaddr* )&server_addr, sizeof( server_addr ) ) < 0 ) {
+        close( fd );
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_all( int fd, const std::string& data ) {
+    size_t sent = 0;
+    while ( sent < data.size() ) {
+        ssize_t n = send( fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL );
+        if ( n <= 0 ) {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+// 读一个完整的响应（按Content-Length），返回响应体，出错返回false
+static bool recv_response( int fd, std::string& pending, std::string& body ) {
+    char buf[ 65536 ];
+    while ( true ) {
+        size_t end = pending.find( "\r\n\r\n" );
+        if ( end != std::string::npos ) {
+            size_t cl = pending.find( "Content-Length: " );
+            if ( cl != std::string::npos && cl < end ) {
+                size_t len = strtoul( pending.c_str() + cl + 16, NULL, 10 );
+                if ( pending.size() >= end + 4 + len ) {
+                    body = pending.substr( end + 4, len );
+                    pending.erase( 0, end + 4 + len );
+                    return true;
+                }
+            }
+        }
+        ssize_t n = recv( fd, buf, sizeof( buf ), 0 );
+        if ( n <= 0 ) {
+            return false;
+        }
+        pending.append( buf, n );
+    }
+}
+
+static bool upload( long size, bool chunked ) {
+    int fd = connect_server();
+    if ( fd < 0 ) {
+        perror( "connect" );
+        return false;
+    }
+    std::string req = "POST /upload HTTP/1.1\r\nConnection: keep-alive\r\n";
+    std::string payload( size, 'x' );
+    if ( chunked ) {
+        req += "Transfer-Encoding: chunked\r\n\r\n";
+        //每块最多32KB，块边界和服务器的读缓冲区边界错开
+        for ( long off = 0; off < size; off += 32768 ) {
+            long n = size - off < 32768 ? size - off : 32768;
+            char line[ 32 ];
+            snprintf( line, sizeof( line ), "%lx\r\n", n );
+            req += line;
+            req.append( payload, off, n );
+            req += "\r\n";
+        }
+        req += "0\r\n\r\n";
+    } else {
+        char line[ 64 ];
+        snprintf( line, sizeof( line ), "Content-Length: %ld\r\n\r\n", size );
+        req += line;
+        req += payload;
+    }
+    req += "GET /index.html HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+
+    std::string pending, body, page;
+    bool ok = send_all( fd, req ) && recv_response( fd, pending, body ) && recv_response( fd, pending, page );
+    char expect[ 64 ];
+    snprintf( expect, sizeof( expect ), "received %ld bytes%s\n", size, chunked ? " (chunked)" : "" );
+    ok = ok && body == expect && !page.empty();
+    printf( "%-8s %8ld bytes: %s\n", chunked ? "chunked" : "length", size, ok ? "OK" : "FAIL" );
+    close( fd );
+    return ok;
+}
+
+int main( int argc, char* argv[] ) {
+    if ( argc < 3 ) {
+        printf( "usage: %s ip port\n", argv[ 0 ] );
+        return 1;
+    }
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons( atoi( argv[ 2 ] ) );
+    inet_pton( AF_INET, argv[ 1 ], &server_addr.sin_addr );
+
+    long sizes[] = { 60000, 70000, 100000, 1000000 };
+    int failed = 0;
+    for ( int i = 0; i < 4; ++i ) {
+        failed += !upload( sizes[ i ], false );
+        failed += !upload( sizes[ i ], true );
+    }
+    printf( "%s\n", failed ? "FAILED" : "ALL OK" );
+    return failed ? 1 : 0;
+}
@@ -3,21 +3,52 @@
 
 #include <pthread.h>
 #include <list>
+#include <deque>
+#include <atomic>
 #include <exception>
 #include "locker.h"
+#include "mpmc_queue.h"
+#include "log.h"
+#include "metrics.h"
 #include <cstdio>
 
+/*
+任务队列的组织方式
+QUEUE_LOCKED        :   一个全局队列，互斥锁+链表+信号量
+QUEUE_LOCK_FREE     :   一个全局的有界无锁环形队列
+QUEUE_WORK_STEALING :   每个工作线程一个双端队列，任务优先交给上次处理同一请求对象的线程
+                        （T需要有int类型的公有成员worker），空闲线程从其他线程的队列尾部窃取
+T还需要有long类型的公有成员queued_at，入队时记下时间，用于统计排队的延迟
+*/
+enum QUEUE_MODE { QUEUE_LOCKED = 0, QUEUE_LOCK_FREE, QUEUE_WORK_STEALING };
+
 template<typename T>
 class threadpool{
 
 public:
-    threadpool(int thread_number = 8, int max_requests = 10000);
+    threadpool(int thread_number = 8, int max_requests = 10000, QUEUE_MODE mode = QUEUE_LOCKED);
     ~threadpool();
     bool append(T* request);
+    // 已入队还没有开始处理的任务数，用于准入控制，是近似值
+    int pending() { return m_pending.load(std::memory_order_relaxed); }
 
 private:
     static void * worker(void * arg);
     void run();
+    void handle(T* request);
+    bool push(T* request);
+    bool append_local(T* request);
+    void run_local(int id);
+    T* pop_local(int id);
+    T* steal(int id);
+
+    //工作窃取模式下每个线程自己的队列
+    struct local_queue {
+        locker lock;
+        std::deque<T*> tasks;
+        sem wakeup;
+        std::atomic<bool> idle;
+    };
 
 private:
     
@@ -27,46 +58,91 @@ private:
     std::list<T*> m_workqueue;
     locker m_queuelocker;
     sem m_queuestat;
-    bool m_stop;
+    mpmc_queue<T>* m_ringqueue;   //无锁模式下的任务队列，否则为NULL
+    local_queue* m_localqueues;   //工作窃取模式下每个线程的队列，否则为NULL
+    std::atomic<int> m_next_queue;
+    std::atomic<int> m_next_id;
+    std::atomic<int> m_pending;
+    std::atomic<bool> m_stop;
 
 };
 
 template<typename T>
-threadpool<T>::threadpool(int thread_number, int max_requests) :
+threadpool<T>::threadpool(int thread_number, int max_requests, QUEUE_MODE mode) :
     m_thread_number(thread_number), m_max_requests(max_requests), 
-    m_stop(false), m_threads(NULL) {
+    m_stop(false), m_threads(NULL), m_ringqueue(NULL), m_localqueues(NULL),
+    m_next_queue(0), m_next_id(0), m_pending(0) {
         if ((thread_number <= 0) || (max_requests <= 0)){
             throw std::exception();
         }
+        if (mode == QUEUE_LOCK_FREE){
+            m_ringqueue = new mpmc_queue<T>(max_requests);
+        } else if (mode == QUEUE_WORK_STEALING){
+            m_localqueues = new local_queue[m_thread_number];
+            for (int i = 0; i < m_thread_number; i++){
+                m_localqueues[i].idle = false;
+            }
+        }
 
         //创建线程池
         m_threads = new pthread_t[m_thread_number]; 
         if(!m_threads){
             throw std::exception();
         }
-        //创建线程并设置线程分离，用完自动销毁
+        //创建线程，析构时等它们全部退出后才释放队列
         for (int i = 0; i < m_thread_number; i++){  //1、参数1指向pthread_t*  2、worker函数需要是静态函数，规定，线程的回调函数必须是静态函数。
-            printf("create the %dth thread\n", i);
+            LOG_INFO("create the %dth thread", i);
             if (pthread_create(m_threads + i, NULL, worker, this) != 0){
                 delete [] m_threads;
                 throw std::exception();
             }  
-
-            if (pthread_detach(m_threads[i])){
-                delete [] m_threads;
-                throw std::exception();
-            }
         }
     }
 
 template<typename T>
 threadpool<T>::~threadpool(){
-    delete [] m_threads;
     m_stop = true; 
+    //叫醒所有等待任务的线程，它们回到循环开头看到m_stop后退出
+    if (m_ringqueue){
+        m_ringqueue->close();
+    } else if (m_localqueues){
+        for (int i = 0; i < m_thread_number; i++){
+            m_localqueues[i].wakeup.post();
+        }
+    } else {
+        for (int i = 0; i < m_thread_number; i++){
+            m_queuestat.post();
+        }
+    }
+    for (int i = 0; i < m_thread_number; i++){
+        pthread_join(m_threads[i], NULL);
+    }
+    //线程都退出后才能释放：工作线程可能还在pop_local/steal中，或者等在自己队列的信号量上
+    delete [] m_threads;
+    delete m_ringqueue;
+    delete [] m_localqueues;
 }
 
 template<typename T>
 bool threadpool<T>::append(T* request){
+    request->queued_at = metrics::now();
+    //先计数再入队，否则工作线程可能先取走任务减了计数
+    m_pending.fetch_add(1, std::memory_order_relaxed);
+    if (!push(request)){
+        m_pending.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+template<typename T>
+bool threadpool<T>::push(T* request){
+    if (m_ringqueue){
+        return m_ringqueue->push(request);
+    }
+    if (m_localqueues){
+        return append_local(request);
+    }
     m_queuelocker.lock(); 
     if (m_workqueue.size() > m_max_requests){
         m_queuelocker.unlock();
@@ -85,9 +161,27 @@ void* threadpool<T>::worker(void* arg) {
     return pool;
 }
 
+template<typename T>
+void threadpool<T>::handle(T* request){
+    m_pending.fetch_sub(1, std::memory_order_relaxed);
+    metrics::record_since(STAGE_QUEUE, request->queued_at);
+    request->process();
+}
+
 template<typename T>
 void threadpool<T>::run(){
+    if (m_localqueues){
+        run_local(m_next_id++);
+        return;
+    }
     while(!m_stop){
+        if (m_ringqueue){
+            T* request = m_ringqueue->pop();
+            if (request){
+                handle(request);
+            }
+            continue;
+        }
         m_queuestat.wait();
         m_queuelocker.lock();
         if (m_workqueue.empty()){
@@ -100,7 +194,97 @@ void threadpool<T>::run(){
         if (!request){
             continue;
         }
-        request->process();  //线程类做任务。
+        handle(request);  //线程类做任务。
+    }
+}
+
+template<typename T>
+bool threadpool<T>::append_local(T* request){
+    //优先放到上次处理它的线程，它的缓存里还有这个请求的数据
+    int id = request->worker;
+    if (id < 0 || id >= m_thread_number){
+        id = (unsigned)m_next_queue++ % m_thread_number;
+    }
+    local_queue& q = m_localqueues[id];
+    q.lock.lock();
+    if ((int)q.tasks.size() >= m_max_requests / m_thread_number + 1){
+        q.lock.unlock();
+        return false;
+    }
+    q.tasks.push_back(request);
+    q.lock.unlock();
+    q.wakeup.post();
+
+    //目标线程正忙，叫醒一个空闲线程来窃取
+    if (!q.idle){
+        for (int i = 1; i < m_thread_number; i++){
+            local_queue& other = m_localqueues[(id + i) % m_thread_number];
+            if (other.idle.exchange(false)){
+                other.wakeup.post();
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+//自己的队列从头部取
+template<typename T>
+T* threadpool<T>::pop_local(int id){
+    local_queue& q = m_localqueues[id];
+    T* request = NULL;
+    q.lock.lock();
+    if (!q.tasks.empty()){
+        request = q.tasks.front();
+        q.tasks.pop_front();
+    }
+    q.lock.unlock();
+    return request;
+}
+
+//从其他线程的队列尾部窃取，减少和队列主人的冲突
+template<typename T>
+T* threadpool<T>::steal(int id){
+    for (int i = 1; i < m_thread_number; i++){
+        local_queue& q = m_localqueues[(id + i) % m_thread_number];
+        T* request = NULL;
+        q.lock.lock();
+        if (!q.tasks.empty()){
+            request = q.tasks.back();
+            q.tasks.pop_back();
+        }
+        q.lock.unlock();
+        if (request){
+            return request;
+        }
+    }
+    return NULL;
+}
+
+template<typename T>
+void threadpool<T>::run_local(int id){
+    local_queue& q = m_localqueues[id];
+    while(!m_stop){
+        T* request = pop_local(id);
+        if (!request){
+            request = steal(id);
+        }
+        if (!request){
+            //先标记空闲再检查一次，避免和append之间丢失唤醒
+            q.idle = true;
+            request = pop_local(id);
+            if (!request){
+                request = steal(id);
+            }
+            if (!request){
+                q.wakeup.wait();
+                q.idle = false;
+                continue;
+            }
+            q.idle = false;
+        }
+        request->worker = id;
+        handle(request);
     }
 }
 
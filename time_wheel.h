@@ -0,0 +1,166 @@
+#ifndef TIME_WHEEL_H
+#define TIME_WHEEL_H
+
+#include <stdio.h>
+#include <time.h>
+#include "lst_timer.h"
+
+/*
+分层时间轮，添加/刷新/删除都是O(1)。
+时间单位是构造时指定的毫秒数（一般取reactor的tick间隔），到期时间向上取整到单位，保证不会提前触发。
+第0层256个槽，每槽对应1个时间单位；第1~3层各64个槽，每个槽对应下一层转一圈的时间。
+定时器按距离到期的远近放入对应层，上层的槽在下一层转完一圈时被“降级”到下层，
+最终都在第0层到期执行。槽内用util_timer自带的prev/next组成双向链表，slot记录所在槽，
+所以删除时无需遍历。超过最大范围（2^26个单位）的定时器放在最远处。
+*/
+class time_wheel : public timer_container {
+public:
+    time_wheel( int resolution = 1 ) : m_resolution( resolution ) {
+        m_cur = timer_now_ms() / m_resolution;
+        for( int i = 0; i < SLOTS; ++i ) {
+            m_slots[i] = NULL;
+        }
+    }
+
+    ~time_wheel() {
+        for( int i = 0; i < SLOTS; ++i ) {
+            util_timer* tmp = m_slots[i];
+            while( tmp ) {
+                m_slots[i] = tmp->next;
+                delete tmp;
+                tmp = m_slots[i];
+            }
+        }
+    }
+
+    void add_timer( util_timer* timer ) {
+        if( !timer ) {
+            return;
+        }
+        link( timer );
+    }
+
+    void adjust_timer( util_timer* timer ) {
+        if( !timer ) {
+            return;
+        }
+        unlink( timer );
+        link( timer );
+    }
+
+    void del_timer( util_timer* timer ) {
+        if( !timer ) {
+            return;
+        }
+        unlink( timer );
+        delete timer;
+    }
+
+    void tick() {
+        time_t cur = timer_now_ms() / m_resolution;
+        // m_cur是下一个待处理的时间单位，追到当前时间为止
+        while( m_cur <= cur ) {
+            int index = m_cur & ROOT_MASK;
+            // 第0层转完一圈，把上一层当前槽的定时器降级，逐层向上
+            if( index == 0 ) {
+                for( int level = 0; level < LEVELS - 1; ++level ) {
+                    if( cascade( level ) != 0 ) {
+                        break;
+                    }
+                }
+            }
+
+            // 逐个摘下再执行，回调里可能会增删其他定时器
+            util_timer* tmp;
+            while( ( tmp = m_slots[index] ) ) {
+                unlink( tmp );
+                tmp->cb_func( tmp->user_data );
+                delete tmp;
+            }
+            ++m_cur;
+        }
+    }
+
+private:
+    static const int ROOT_BITS = 8;
+    static const int LEVEL_BITS = 6;
+    static const int LEVELS = 4;
+    static const int ROOT_SIZE = 1 << ROOT_BITS;
+    static const int LEVEL_SIZE = 1 << LEVEL_BITS;
+    static const int ROOT_MASK = ROOT_SIZE - 1;
+    static const int LEVEL_MASK = LEVEL_SIZE - 1;
+    static const int SLOTS = ROOT_SIZE + ( LEVELS - 1 ) * LEVEL_SIZE;
+    static const long MAX_SPAN = ( 1L << ( ROOT_BITS + ( LEVELS - 1 ) * LEVEL_BITS ) ) - 1;
+
+    // 根据到期时间计算所在的槽
+    int slot_of( time_t expire_ms ) const {
+        time_t expire = ( expire_ms + m_resolution - 1 ) / m_resolution;
+        time_t idx = expire - m_cur;
+        if( idx < 0 ) {
+            // 已经过期，下一个时间单位执行
+            return m_cur & ROOT_MASK;
+        }
+        if( idx < ROOT_SIZE ) {
+            return expire & ROOT_MASK;
+        }
+        if( idx > MAX_SPAN ) {
+            expire = m_cur + MAX_SPAN;
+            idx = MAX_SPAN;
+        }
+        int level = 1;
+        while( idx >= ( 1L << ( ROOT_BITS + level * LEVEL_BITS ) ) ) {
+            ++level;
+        }
+        int shift = ROOT_BITS + ( level - 1 ) * LEVEL_BITS;
+        return ROOT_SIZE + ( level - 1 ) * LEVEL_SIZE + ( ( expire >> shift ) & LEVEL_MASK );
+    }
+
+    void link( util_timer* timer ) {
+        int slot = slot_of( timer->expire );
+        timer->slot = slot;
+        timer->prev = NULL;
+        timer->next = m_slots[slot];
+        if( m_slots[slot] ) {
+            m_slots[slot]->prev = timer;
+        }
+        m_slots[slot] = timer;
+    }
+
+    void unlink( util_timer* timer ) {
+        if( timer->slot < 0 ) {
+            return;
+        }
+        if( timer->prev ) {
+            timer->prev->next = timer->next;
+        } else {
+            m_slots[timer->slot] = timer->next;
+        }
+        if( timer->next ) {
+            timer->next->prev = timer->prev;
+        }
+        timer->prev = timer->next = NULL;
+        timer->slot = -1;
+    }
+
+    // 把第level+1层当前槽的定时器重新放入更低的层，返回该槽的下标
+    int cascade( int level ) {
+        int shift = ROOT_BITS + level * LEVEL_BITS;
+        int index = ( m_cur >> shift ) & LEVEL_MASK;
+        int slot = ROOT_SIZE + level * LEVEL_SIZE + index;
+        util_timer* tmp = m_slots[slot];
+        m_slots[slot] = NULL;
+        while( tmp ) {
+            util_timer* next = tmp->next;
+            link( tmp );
+            tmp = next;
+        }
+        return index;
+    }
+
+private:
+    util_timer* m_slots[SLOTS];
+    int m_resolution;   // 每个时间单位的毫秒数
+    time_t m_cur;
+};
+
+#endif